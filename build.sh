@@ -1,2 +1,2 @@
 #!/bin/bash
-g++ main.cpp -o run -I "." -O6 -DNDEBUG -std=c++0x -march=native -mtune=native
+g++ main.cpp -o run -I "." -O6 -DNDEBUG -std=c++0x -march=native -mtune=native -pthread
@@ -12,6 +12,23 @@
 #include <chrono>
 #include <utility>
 #include <algorithm>
+#include <cstring>
+#include <climits>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <csignal>
+#include <unordered_map>
+#include <functional>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  #include <immintrin.h>
+  #include <intrin.h>
+#endif
 
 #include "jzq.h"
 
@@ -30,8 +47,20 @@ std::vector<std::string> cityNames;
 Tour globalBestTour;
 int globalBestCost;
 
+// the search threads share the best tour through updateGlobalBest and getGlobalBestTour, and printBestTourAndExit
+// holds the lock while it prints the tour
+std::mutex globalBestMutex;
+thread_local int improvementsOfThisThread = 0; // how many times this thread improved the shared best
+
+// the most threads a search may spread over, or 0 for one per core. the portfolio runs one search per thread,
+// so its threads limit themselves to one
+thread_local int maxSearchThreads = 0;
+
 std::chrono::steady_clock::time_point timeStart;
-double timeOut = 29.9;
+double timeOut = 29.9; // the time budget in seconds, can be changed with --time
+
+// raised by the deadline timer or by SIGINT/SIGTERM, the searches poll it through checkTimeOut
+std::atomic<bool> stopRequested(false);
 
 const int COST_MAX = 32767500; // (500*65535)
 
@@ -69,16 +98,161 @@ void printTour(FILE* file,const Tour& tour,const Array3<int>& flightCosts,const
   }
 }
 
-void checkTimeOut()
+// with --stream, every new shared best is written as one line "cost seconds city city ... city" to a file. the
+// search threads only queue the tours, the writes happen on a writer thread so that a slow file never stalls them
+struct TourStream
 {
-  if(elapsedTime(timeStart)>=timeOut)
+  struct Record
   {
-    if(!globalBestTour.empty()) { printTour(stdout,globalBestTour,flightCosts,cityNames); }
+    int    cost;
+    double time;
+    Tour   tour;
+  };
 
-    exit(0);
+  FILE*                   file;
+  std::vector<Record>     queue;
+  bool                    closing;
+  std::mutex              mutex;
+  std::condition_variable queueChanged;
+  std::thread             writer;
+
+  TourStream():file(0),closing(false) {}
+  ~TourStream() { close(); } // the exit paths that don't go through printBestTourAndExit
+
+  bool open(const char* fileName)
+  {
+    file = fopen(fileName,"w");
+    if(file==0) { return false; }
+    writer = std::thread([this]() { writeRecords(); });
+    return true;
+  }
+
+  void push(const Tour& tour,const int cost)
+  {
+    if(file==0) { return; }
+    std::lock_guard<std::mutex> lock(mutex);
+    Record record = { cost,elapsedTime(timeStart),tour };
+    queue.push_back(record);
+    queueChanged.notify_one();
+  }
+
+  void writeRecords()
+  {
+    std::vector<Record> records;
+    while(1)
+    {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        queueChanged.wait(lock,[this]() { return closing || !queue.empty(); });
+        if(queue.empty()) { return; } // only when closing
+        std::swap(records,queue);
+      }
+
+      for(int i=0;i<records.size();i++)
+      {
+        fprintf(file,"%d %.3f",records[i].cost,records[i].time);
+        for(int day=0;day<records[i].tour.size();day++) { fprintf(file," %s",cityNames[records[i].tour[day]].c_str()); }
+        fprintf(file,"\n");
+      }
+      fflush(file);
+      records.clear();
+    }
+  }
+
+  // writes out the records that are still queued and waits for the writer to finish
+  void close()
+  {
+    if(file==0) { return; }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closing = true;
+      queueChanged.notify_one();
+    }
+    writer.join();
+    fclose(file);
+    file = 0;
   }
+};
+
+TourStream tourStream;
+
+// the lock is never released, so when several threads stop at once only the first one gets to print. _Exit
+// skips the destructors of the globals, which the other search threads may still be reading
+void printBestTourAndExit()
+{
+  globalBestMutex.lock();
+
+  if(!globalBestTour.empty()) { printTour(stdout,globalBestTour,flightCosts,cityNames); }
+
+  fflush(stdout);
+  tourStream.close();
+  std::_Exit(0);
+}
+
+// cheap enough for the inner loops, it's a single load of the flag
+void checkTimeOut()
+{
+  if(stopRequested.load(std::memory_order_relaxed)) { printBestTourAndExit(); }
+}
+
+void handleStopSignal(int)
+{
+  stopRequested = true;
+}
+
+// the timer thread raises stopRequested when the time budget runs out. when the tour doesn't get printed within
+// the grace period, e.g. because a constructor that doesn't poll checkTimeOut is still running, the timer thread
+// prints the best tour so far by itself
+void startDeadlineTimer(const double gracePeriod=0.1)
+{
+  std::signal(SIGINT,handleStopSignal);
+  std::signal(SIGTERM,handleStopSignal);
+
+  std::thread([gracePeriod]()
+  {
+    while(!stopRequested && elapsedTime(timeStart)<timeOut) { std::this_thread::sleep_for(std::chrono::milliseconds(5)); }
+    stopRequested = true;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(int(gracePeriod*1000.0)));
+    printBestTourAndExit();
+  }).detach();
 }
 
+// offers the tour to the shared best, returns true when it becomes the new best tour
+bool updateGlobalBest(const Tour& tour,const int cost)
+{
+  std::lock_guard<std::mutex> lock(globalBestMutex);
+  if(cost<0 || cost>=globalBestCost) { return false; }
+  globalBestTour = tour;
+  globalBestCost = cost;
+  improvementsOfThisThread++;
+  tourStream.push(tour,cost); // under the lock, so the stream sees the tours in the order of decreasing cost
+  return true;
+}
+
+Tour getGlobalBestTour()
+{
+  std::lock_guard<std::mutex> lock(globalBestMutex);
+  return globalBestTour;
+}
+
+// xorshift generator. each search thread owns one, so the threads don't contend for the state of rand(), which
+// isn't guaranteed to be thread-safe anyway
+struct FastRandom
+{
+  unsigned int state;
+
+  FastRandom(unsigned int seed) : state(seed!=0 ? seed : 1) {}
+
+  unsigned int next() { state ^= state<<13; state ^= state>>17; state ^= state<<5; return state; }
+  int operator()(const int n) { return int(next()%(unsigned int)n); } // uniform in [0,n)
+  double uniform() { return double(next())/4294967296.0; }           // uniform in [0,1)
+};
+
+// the generator of the thread the code runs on, in place of rand(). parallelFor seeds the generators of its
+// workers from the one of the thread that calls it
+thread_local FastRandom threadRandom(1);
+
 Tour makeRandomTour(const int startCity,const int numCities,const Array3<int>& flightCosts,int maxIters=1000)
 {
   for(int iter=0;iter<maxIters;iter++)
@@ -112,24 +286,149 @@ Tour makeRandomTour(const int startCity,const int numCities,const Array3<int>& f
           }
         }
 
-        if(reachableCities.size()>0)
+        if(reachableCities.size()==0) { break; } // dead end, start over
+
+        const int nextCity = reachableCities[threadRandom(reachableCities.size())]; // pick a random city that is reachable
+
+        tour.push_back(nextCity);
+
+        for(int i=0;i<citiesToVisit.size();i++) // remove it from the list of un-visited cities
         {
-          const int nextCity = reachableCities[rand()%reachableCities.size()]; // pick a random city that is reachable
+          if(citiesToVisit[i]==nextCity) { citiesToVisit.erase(citiesToVisit.begin()+i); break; }
+        }
+
+        currCity = nextCity;
+      }
+    }
+  }
+
+  return Tour();
+}
+
+// dayCityDomain(day,city) is 1 when the city can be visited on the given day. day 0 and the last day belong
+// to the startCity. the domain is reduced by propagating two kinds of constraints until nothing changes:
+// - a city can be visited on a day only when it has a flight in from some city that can be visited on the
+//   previous day, and a flight out to some city that can be visited on the next day.
+// - a day that has only one city left is fixed to it, so the city can't be visited on any other day, and
+//   a city that has only one day left is fixed to it, so no other city can be visited on that day.
+Array2<unsigned char> makeDayCityDomain(const int startCity,const int numCities,const Array3<int>& flightCosts)
+{
+  Array2<unsigned char> dayCityDomain(numCities+1,numCities);
+  for(int i=0;i<dayCityDomain.numel();i++) { dayCityDomain[i] = 0; }
+
+  for(int day=0;day<=numCities;day++)
+  for(int city=0;city<numCities;city++)
+  {
+    const bool isStartDay = (day==0 || day==numCities);
+    dayCityDomain(day,city) = (isStartDay==(city==startCity)) ? 1 : 0;
+  }
+
+  Array2<int> inSupport(numCities+1,numCities);  // number of cities on the previous day with a flight to the city
+  Array2<int> outSupport(numCities+1,numCities); // number of cities on the next day with a flight from the city
+  for(int i=0;i<inSupport.numel();i++) { inSupport[i] = 0; outSupport[i] = 0; }
+
+  for(int day=0;day<numCities;day++)
+  for(int fromCity=0;fromCity<numCities;fromCity++)
+  for(int toCity=0;toCity<numCities;toCity++)
+  {
+    if(flightCosts(day,fromCity,toCity)>0 && dayCityDomain(day,fromCity) && dayCityDomain(day+1,toCity))
+    {
+      inSupport(day+1,toCity)++;
+      outSupport(day,fromCity)++;
+    }
+  }
+
+  std::vector<Vec2i> removed; // (day,city) pairs that were removed from the domain but not propagated yet
 
-          tour.push_back(nextCity);
+  for(int day=0;day<=numCities;day++)
+  for(int city=0;city<numCities;city++)
+  {
+    if(dayCityDomain(day,city) && ((day>0 && inSupport(day,city)==0) || (day<numCities && outSupport(day,city)==0)))
+    {
+      dayCityDomain(day,city) = 0;
+      removed.push_back(Vec2i(day,city));
+    }
+  }
+
+  while(1)
+  {
+    while(!removed.empty())
+    {
+      const int day = removed.back()(0);
+      const int city = removed.back()(1);
+      removed.pop_back();
 
-          for(int i=0;i<citiesToVisit.size();i++) // remove it from the list of un-visited cities
+      if(day<numCities)
+      {
+        for(int toCity=0;toCity<numCities;toCity++)
+        {
+          if(flightCosts(day,city,toCity)>0 && dayCityDomain(day+1,toCity) && --inSupport(day+1,toCity)==0)
           {
-            if(citiesToVisit[i]==nextCity) { citiesToVisit.erase(citiesToVisit.begin()+i); break; }
+            dayCityDomain(day+1,toCity) = 0;
+            removed.push_back(Vec2i(day+1,toCity));
           }
+        }
+      }
 
-          currCity = nextCity;
+      if(day>0)
+      {
+        for(int fromCity=0;fromCity<numCities;fromCity++)
+        {
+          if(flightCosts(day-1,fromCity,city)>0 && dayCityDomain(day-1,fromCity) && --outSupport(day-1,fromCity)==0)
+          {
+            dayCityDomain(day-1,fromCity) = 0;
+            removed.push_back(Vec2i(day-1,fromCity));
+          }
         }
       }
     }
+
+    std::vector<int> numCitiesOnDay(numCities+1,0);
+    std::vector<int> numDaysOfCity(numCities,0);
+    for(int day=1;day<numCities;day++)
+    for(int city=0;city<numCities;city++)
+    {
+      if(dayCityDomain(day,city)) { numCitiesOnDay[day]++; numDaysOfCity[city]++; }
+    }
+
+    std::vector<int> fixedDayOfCity(numCities,-1);  // the day that has only this city left
+    std::vector<int> fixedCityOfDay(numCities+1,-1); // the city that has only this day left
+    for(int day=1;day<numCities;day++)
+    for(int city=0;city<numCities;city++)
+    {
+      if(dayCityDomain(day,city) && numCitiesOnDay[day]==1) { fixedDayOfCity[city] = day; }
+      if(dayCityDomain(day,city) && numDaysOfCity[city]==1) { fixedCityOfDay[day] = city; }
+    }
+
+    for(int day=1;day<numCities;day++)
+    for(int city=0;city<numCities;city++)
+    {
+      if(dayCityDomain(day,city) && ((fixedDayOfCity[city]>=0 && fixedDayOfCity[city]!=day) ||
+                                     (fixedCityOfDay[day]>=0  && fixedCityOfDay[day]!=city)))
+      {
+        dayCityDomain(day,city) = 0;
+        removed.push_back(Vec2i(day,city));
+      }
+    }
+
+    if(removed.empty()) { break; } // reached the fixed point
   }
 
-  return Tour();
+  return dayCityDomain;
+}
+
+// removes the flights that can't be part of any valid tour according to the dayCityDomain, so the constructors
+// and the local search never consider them. when a day is fixed to a single city, this leaves only the forced legs.
+void pruneFlightCosts(const Array2<unsigned char>& dayCityDomain,const int numCities,Array3<int>* inout_flightCosts)
+{
+  Array3<int>& flightCosts = *inout_flightCosts;
+
+  for(int day=0;day<numCities;day++)
+  for(int fromCity=0;fromCity<numCities;fromCity++)
+  for(int toCity=0;toCity<numCities;toCity++)
+  {
+    if(!dayCityDomain(day,fromCity) || !dayCityDomain(day+1,toCity)) { flightCosts(day,fromCity,toCity) = -1; }
+  }
 }
 
 Array2<std::vector<CityCost>> sortOutboundFlights(const Array3<int>& flightCosts,const int numCities)
@@ -182,6 +481,175 @@ Array2<std::vector<CityCost>> sortInboundFlights(const Array3<int>& flightCosts,
   return inboundFlights;
 }
 
+// backtracking search for a feasible tour with forward checking. each day keeps a domain of the cities that
+// can still be visited on it, and each city keeps a count of the days it can still be visited on. visiting a
+// city on a day removes the city from all the other days, and it removes the cities that have no flight to or
+// from it from the domains of the neighboring days. when some day runs out of cities, or when some city runs
+// out of days, the branch is a dead end and we backtrack right away. days are filled in the "most constrained
+// first" order, i.e. the day with the fewest cities left goes first, and the cities with fewer days left are
+// tried first, cheaper flights breaking the ties.
+Tour makeTourWithBacktracking(const int startCity,
+                              const int numCities,
+                              const Array3<int>& flightCosts,
+                              const Array2<unsigned char>& dayCityDomain,
+                              const int maxIters=10000,
+                              const int maxNodesPerIter=2000)
+{
+  struct Search
+  {
+    int startCity;
+    int numCities;
+    const Array3<int>& flightCosts;
+
+    Tour tour;                       // tour[day] is -1 while the day is still open
+    Array2<unsigned char> domain;    // domain(day,city) is 1 when the city can still be visited on the day
+    std::vector<int> domainSize;     // number of cities that can still be visited on the day
+    std::vector<int> cityDays;       // number of days the city can still be visited on
+    std::vector<Vec2i> trail;        // (day,city) pairs removed from the domain, used to undo them on backtrack
+    int numNodes;
+    int maxNodes;
+    bool randomize;
+
+    Search(int startCity,int numCities,const Array3<int>& flightCosts,const Array2<unsigned char>& dayCityDomain)
+      : startCity(startCity),numCities(numCities),flightCosts(flightCosts),
+        tour(numCities+1,-1),domain(dayCityDomain),domainSize(numCities+1,0),cityDays(numCities,0),
+        numNodes(0),maxNodes(0),randomize(false)
+    {
+      tour[0] = startCity;
+      tour[numCities] = startCity;
+
+      for(int day=1;day<numCities;day++)
+      for(int city=0;city<numCities;city++)
+      {
+        if(city==startCity) { domain(day,city) = 0; }
+        if(domain(day,city)) { domainSize[day]++; cityDays[city]++; }
+      }
+    }
+
+    bool remove(const int day,const int city) // returns false when the removal leads to a dead end
+    {
+      domain(day,city) = 0;
+      domainSize[day]--;
+      cityDays[city]--;
+      trail.push_back(Vec2i(day,city));
+      return domainSize[day]>0 && cityDays[city]>0;
+    }
+
+    void undo(const int trailSize)
+    {
+      while(trail.size()>trailSize)
+      {
+        const Vec2i dayCity = trail.back();
+        domain(dayCity(0),dayCity(1)) = 1;
+        domainSize[dayCity(0)]++;
+        cityDays[dayCity(1)]++;
+        trail.pop_back();
+      }
+    }
+
+    bool visit(const int day,const int city) // visits the city on the day and propagates the consequences to the other days
+    {
+      bool feasible = true;
+
+      tour[day] = city;
+
+      for(int other=0;other<numCities;other++)
+      {
+        if(other!=city && domain(day,other)) { feasible &= remove(day,other); }
+      }
+
+      for(int otherDay=1;otherDay<numCities;otherDay++)
+      {
+        if(otherDay!=day && domain(otherDay,city)) { feasible &= remove(otherDay,city); }
+      }
+
+      if(day>1 && tour[day-1]<0)
+      {
+        for(int prevCity=0;prevCity<numCities;prevCity++)
+        {
+          if(domain(day-1,prevCity) && flightCosts(day-1,prevCity,city)<0) { feasible &= remove(day-1,prevCity); }
+        }
+      }
+
+      if(day<numCities-1 && tour[day+1]<0)
+      {
+        for(int nextCity=0;nextCity<numCities;nextCity++)
+        {
+          if(domain(day+1,nextCity) && flightCosts(day,city,nextCity)<0) { feasible &= remove(day+1,nextCity); }
+        }
+      }
+
+      return feasible;
+    }
+
+    int legsCost(const int day,const int city) const // cost of the flights to and from the neighbors that are already fixed
+    {
+      int cost = 0;
+      if(tour[day-1]>=0) { cost += flightCosts(day-1,tour[day-1],city); }
+      if(tour[day+1]>=0) { cost += flightCosts(day,city,tour[day+1]); }
+      return cost;
+    }
+
+    bool extend()
+    {
+      int day = -1;
+      int numTies = 0;
+      for(int d=1;d<numCities;d++)
+      {
+        if(tour[d]>=0) { continue; }
+
+        if(day<0 || domainSize[d]<domainSize[day]) { day = d; numTies = 1; }
+        else if(randomize && domainSize[d]==domainSize[day] && threadRandom(++numTies)==0) { day = d; } // pick one of the tied days at random
+      }
+
+      if(day<0) { return true; } // all days are filled, the tour is complete
+
+      if(numNodes++>=maxNodes) { return false; }
+
+      std::vector<CityCost> candidates;
+      for(int city=0;city<numCities;city++)
+      {
+        if(domain(day,city)) { candidates.push_back(CityCost(city,legsCost(day,city))); }
+      }
+
+      if(randomize) { for(int i=int(candidates.size())-1;i>0;i--) { std::swap(candidates[i],candidates[threadRandom(i+1)]); } }
+      else          { std::sort(candidates.begin(),candidates.end()); }
+
+      std::stable_sort(candidates.begin(),candidates.end(),[&](const CityCost& a,const CityCost& b) { return cityDays[a.city]<cityDays[b.city]; });
+
+      for(int i=0;i<candidates.size();i++)
+      {
+        const int trailSize = trail.size();
+
+        if(visit(day,candidates[i].city) && extend()) { return true; }
+
+        undo(trailSize);
+        tour[day] = -1;
+
+        if(numNodes>=maxNodes) { return false; }
+      }
+
+      return false;
+    }
+  };
+
+  for(int iter=0;iter<maxIters;iter++) // restart with a randomized order when the search gets stuck in a deep dead end
+  {
+    checkTimeOut();
+
+    Search search(startCity,numCities,flightCosts,dayCityDomain);
+    search.maxNodes = maxNodesPerIter;
+    search.randomize = (iter>0);
+
+    for(int day=1;day<numCities;day++) { if(search.domainSize[day]==0) { return Tour(); } } // no feasible tour exists
+    for(int city=0;city<numCities;city++) { if(city!=startCity && search.cityDays[city]==0) { return Tour(); } }
+
+    if(search.extend()) { return search.tour; }
+  }
+
+  return Tour();
+}
+
 Tour makeDoubleEndedNNTour(const int fromCity,
                            const int fromDay,
                            const int startCity,
@@ -391,261 +859,3506 @@ Tour makeNNTourWithLookAhead(const int startCity,
   return tour;
 }
 
-Tour doubleBridge(const Tour& tour,const int day1,const int day2,const int day3,const int day4)
+// beam search over the NN extensions: each of the beamWidth cheapest partial tours of the day is extended by
+// the cheapest flights to branching of the cities it hasn't visited yet, and the beamWidth cheapest of all the
+// extensions make it to the next day. unlike the plain NN tour, a cheap first leg doesn't lock in the rest.
+// the cheapest flights are picked from the day's row of flightCosts rather than from sortOutboundFlights, so
+// the beam search can build the initial tour of the rolling horizon on instances where the sorted flights
+// wouldn't fit in memory. when all the extensions run into dead ends, the tour is empty, or with completeDeadEnd,
+// the best partial tour followed by the cities it didn't visit, with some legs missing a flight for repairTour to
+// fix.
+Tour makeBeamSearchTour(const int startCity,
+                        const int numCities,
+                        const Array3<int>& flightCosts,
+                        const int beamWidth=32,
+                        const int branching=4,
+                        const bool completeDeadEnd=false)
 {
-  Tour newTour;
-  for(int i=0;i<day1;i++) { newTour.push_back(tour[i]); }
-  for(int i=day3;i<day4;i++) { newTour.push_back(tour[i]); }
-  for(int i=day2;i<day3;i++) { newTour.push_back(tour[i]); }
-  for(int i=day1;i<day2;i++) { newTour.push_back(tour[i]); }
-  for(int i=day4;i<tour.size();i++) { newTour.push_back(tour[i]); }
-  return newTour;
-}
+  struct Extension
+  {
+    int cost;
+    int parent; // the index of the extended partial tour in the beam
+    int city;
 
-Tour restrictedDoubleBridgeKick(const Tour& tour,const Array3<int>& flightCosts,const double maxAllowedCostIncrease,const int maxIters=100)
-{
-  const int originalCost = evalTourCost(tour,flightCosts);
+    bool operator<(const Extension& other) const { return cost<other.cost; }
+  };
 
-  for(int iter=0;iter<maxIters;iter++) // keep generating double-bridge moves until we find a valid one
+  std::vector<Tour> beam(1,Tour(1,startCity));
+  std::vector<int> beamCosts(1,0);
+  std::vector<std::vector<unsigned char>> beamVisited(1,std::vector<unsigned char>(numCities,0));
+  beamVisited[0][startCity] = 1;
+
+  std::vector<Extension> extensions;
+  std::vector<CityCost> cheapestFlights;
+  for(int day=0;day<numCities;day++)
   {
-    int days[4];
+    extensions.clear();
 
-    while(1)
+    for(int i=0;i<beam.size();i++)
     {
-      for(int i=0;i<4;i++) // generate a 4-tuple of random non-repeating days
+      const int currCity = beam[i].back();
+
+      if(day==numCities-1) // on the last day we have to go back to the city we started from
       {
-      retry:
-        const int d = 1+(rand()%(tour.size()-1));
-        for(int j=0;j<i;j++) if(days[j]==d) { goto retry; }
-        days[i] = d;
+        const int cost = flightCosts(day,currCity,startCity);
+        if(cost>0) { extensions.push_back(Extension{beamCosts[i]+cost,i,startCity}); }
+        continue;
       }
 
-      std::sort(std::begin(days),std::end(days));
+      cheapestFlights.clear(); // kept sorted, at most branching of them
+      for(int city=0;city<numCities;city++)
+      {
+        const int cost = flightCosts(day,currCity,city);
+        if(cost<0 || beamVisited[i][city]) { continue; }
+        if(cheapestFlights.size()==branching && cost>=cheapestFlights.back().cost) { continue; }
+        if(cheapestFlights.size()==branching) { cheapestFlights.pop_back(); }
+        cheapestFlights.insert(std::upper_bound(cheapestFlights.begin(),cheapestFlights.end(),CityCost(city,cost)),CityCost(city,cost));
+      }
 
-      // there should be at least one extra day between each two consecutive days
-      if(days[1]>days[0]+1 &&
-          days[2]>days[1]+1 &&
-          days[3]>days[2]+1)
+      for(int j=0;j<cheapestFlights.size();j++)
       {
-        break; // accept the 4-tuple when this is satisfied. otherwise, generate a new one
+        extensions.push_back(Extension{beamCosts[i]+cheapestFlights[j].cost,i,cheapestFlights[j].city});
+      }
+    }
+
+    if(extensions.empty())
+    {
+      if(!completeDeadEnd) { return Tour(); }
+
+      // the rest of the days are filled by NN, and by any city left when there's no flight
+      Tour tour = beam[0];
+      std::vector<unsigned char> visited = beamVisited[0];
+      for(int restDay=tour.size()-1;restDay<numCities-1;restDay++)
+      {
+        int nextCity = -1;
+        for(int city=0;city<numCities;city++)
+        {
+          if(visited[city]) { continue; }
+          const int cost = flightCosts(restDay,tour.back(),city);
+          if(nextCity<0 || (cost>0 && (flightCosts(restDay,tour.back(),nextCity)<=0 || cost<flightCosts(restDay,tour.back(),nextCity)))) { nextCity = city; }
+        }
+        tour.push_back(nextCity);
+        visited[nextCity] = 1;
       }
+      tour.push_back(startCity);
+      return tour;
     }
 
-    const Tour newTour = doubleBridge(tour,days[0],days[1],days[2],days[3]);
-    const int cost = evalTourCost(newTour,flightCosts);
-    if(cost>0 && (cost<maxAllowedCostIncrease*originalCost))
+    const int newBeamSize = std::min(beamWidth,int(extensions.size()));
+    std::partial_sort(extensions.begin(),extensions.begin()+newBeamSize,extensions.end());
+
+    std::vector<Tour> newBeam(newBeamSize);
+    std::vector<int> newBeamCosts(newBeamSize);
+    std::vector<std::vector<unsigned char>> newBeamVisited(newBeamSize);
+    for(int i=0;i<newBeamSize;i++)
     {
-      return newTour;
+      const Extension& extension = extensions[i];
+      newBeam[i] = beam[extension.parent];
+      newBeam[i].push_back(extension.city);
+      newBeamCosts[i] = extension.cost;
+      newBeamVisited[i] = beamVisited[extension.parent];
+      newBeamVisited[i][extension.city] = 1;
     }
+    beam.swap(newBeam);
+    beamCosts.swap(newBeamCosts);
+    beamVisited.swap(newBeamVisited);
   }
 
-  return Tour();
+  return beam[0];
 }
 
-Tour perform2Opt(const Tour& initialTour,const Array3<int>& flightCosts)
+// cheapest insertion with regret-k. the tour grows from both of its ends: the head is flown from day 0 on, and
+// the tail ends with the flight back to the start city on the last day, with a gap of the days still to fill in
+// between. a city inserted into the head moves the rest of the head a day later, and a city inserted into the
+// tail moves the part of the tail before it a day earlier, so every leg of the partial tour is flown on its final
+// day and the insertion cost includes the change of the moved legs. only the leg across the gap is unknown, it's
+// counted once the gap gets closed. the city that goes next is the one with the largest regret, the sum of how
+// much more its k-1 next best insertions cost than its best one, so the cities with few good places get them
+// first. the regrets are kept in a priority queue and only recomputed when they reach the top (lazy
+// invalidation): a stale regret is recomputed, and the city is inserted when its fresh regret still beats the
+// next one in the queue. every insertion shifts the days of the legs after it, so it makes all the queued regrets
+// stale, and a step can recompute O(numCities) of them in the worst case. that's O(numCities^3) flight lookups
+// in total, about as much as the sorted flights cost, which is fine for a fallback constructor. returns an empty
+// tour when some leg of the finished tour has no flight.
+Tour makeRegretInsertionTour(const int startCity,
+                             const int numCities,
+                             const Array3<int>& flightCosts,
+                             const int regretK=3)
 {
-  Tour bestTour = initialTour;
-  int bestCost = evalTourCost(bestTour,flightCosts);
+  const int missingLegCost = 1000000; // a leg without a flight still gets a cost while the tour grows
 
-  while(1)
+  const auto legCost = [&](const int day,const int from,const int to)
   {
-  from_scratch:
-    checkTimeOut();
+    const int flightCost = flightCosts(day,from,to);
+    return (flightCost<0) ? (long long)missingLegCost : (long long)flightCost;
+  };
 
-    for(int day1=1;day1<bestTour.size()-2;day1++)
-    {
-      Tour tour = bestTour;
+  struct Entry
+  {
+    long long regret;
+    long long cost;
+    int city;
+    int position; // an index into the head when it's not negative, otherwise -1-(an index into the tail)
+    int step;     // the step the entry was computed at, it's stale once a city was inserted since
 
-      const int city1 = bestTour[day1];
-      const int costFromTo1 = flightCosts(day1-1,bestTour[day1-1],city1)+
-                              flightCosts(day1  ,city1,bestTour[day1+1]);
+    bool operator<(const Entry& other) const { return regret<other.regret || (regret==other.regret && cost>other.cost); }
+  };
 
-      for(int day2=day1+1;day2<bestTour.size()-1;day2++)
-      {
-        // swap
-        if(day2==day1+1)
-        {
-          std::swap(bestTour[day1],bestTour[day2]);
-          int cost = evalTourCost(bestTour,flightCosts);
-          if(cost>0 && cost<bestCost)
-          {
-            bestCost = cost;
-            goto from_scratch;
-          }
-          std::swap(bestTour[day1],bestTour[day2]);
-        }
-        else
+  std::vector<int> head(1,startCity); // head[i] is visited on day i
+  std::vector<int> tail(1,startCity); // tail[i] is visited on day numCities-tail.size()+1+i
+  head.reserve(numCities);
+  tail.reserve(numCities);
+
+  // the cost change when the head after the index moves a day later, and when the tail before the index moves
+  // a day earlier
+  std::vector<long long> headShiftSums(numCities+1,0);
+  std::vector<long long> tailShiftSums(numCities+1,0);
+
+  std::vector<long long> bestCosts(regretK);
+
+  // the best insertion of the city into the partial tour of the step, and its regret
+  auto evalEntry = [&](const int city,const int step)
+  {
+    const int h = head.size();
+    const int t = tail.size();
+    const int firstTailDay = numCities-t+1;
+    const bool closesGap = (h+t==numCities);
+
+    for(int j=0;j<regretK;j++) { bestCosts[j] = LLONG_MAX; }
+
+    Entry entry;
+    entry.city = city;
+    entry.step = step;
+    entry.position = 0;
+
+    for(int p=-t;p<h;p++)
+    {
+      long long cost = 0;
+      if(p>=0) // after head[p]
+      {
+        cost = legCost(p,head[p],city);
+        if(p<h-1)   { cost += legCost(p+1,city,head[p+1])-legCost(p,head[p],head[p+1])+headShiftSums[p]; }
+        if(closesGap) { cost += (p<h-1) ? legCost(h,head[h-1],tail[0]) : legCost(h,city,tail[0]); }
+      }
+      else // before tail[q]
+      {
+        const int q = -1-p;
+        const int day = firstTailDay+q; // the day of tail[q]
+        cost = legCost(day-1,city,tail[q]);
+        if(q==0 && closesGap) { continue; } // the same as appending to the head
+        if(q>0)       { cost += legCost(day-2,tail[q-1],city)-legCost(day-1,tail[q-1],tail[q])+tailShiftSums[q]; }
+        if(closesGap) { cost += legCost(h-1,head[h-1],tail[0]); }
+      }
+
+      if(cost<bestCosts[0]) { entry.position = p; }
+      for(int j=0;j<regretK;j++) { if(cost<bestCosts[j]) { std::swap(cost,bestCosts[j]); } } // keeps the k best ones sorted
+    }
+
+    entry.cost = bestCosts[0];
+    entry.regret = 0;
+    for(int j=1;j<regretK;j++) { entry.regret += (bestCosts[j]==LLONG_MAX) ? missingLegCost : bestCosts[j]-bestCosts[0]; }
+    return entry;
+  };
+
+  std::vector<Entry> queue;
+  for(int city=0;city<numCities;city++)
+  {
+    if(city!=startCity) { queue.push_back(evalEntry(city,0)); }
+  }
+  std::make_heap(queue.begin(),queue.end());
+
+  for(int step=0;!queue.empty();)
+  {
+    std::pop_heap(queue.begin(),queue.end());
+    Entry entry = queue.back();
+    queue.pop_back();
+
+    if(entry.step!=step)
+    {
+      entry = evalEntry(entry.city,step);
+      if(!queue.empty() && entry<queue.front())
+      {
+        queue.push_back(entry);
+        std::push_heap(queue.begin(),queue.end());
+        continue;
+      }
+    }
+
+    step++;
+
+    if(entry.position>=0)
+    {
+      head.insert(head.begin()+entry.position+1,entry.city);
+
+      const int h = head.size();
+      headShiftSums[h-1] = 0;
+      for(int p=h-2;p>=0;p--)
+      {
+        headShiftSums[p] = (p+1<h-1) ? headShiftSums[p+1]+legCost(p+2,head[p+1],head[p+2])-legCost(p+1,head[p+1],head[p+2]) : 0;
+      }
+    }
+    else
+    {
+      tail.insert(tail.begin()+(-1-entry.position),entry.city);
+
+      const int t = tail.size();
+      const int firstTailDay = numCities-t+1;
+      tailShiftSums[0] = 0;
+      for(int q=1;q<t;q++)
+      {
+        const int day = firstTailDay+q-1; // the day of tail[q-1], the legs before it move a day earlier
+        tailShiftSums[q] = (q>1) ? tailShiftSums[q-1]+legCost(day-2,tail[q-2],tail[q-1])-legCost(day-1,tail[q-2],tail[q-1]) : 0;
+      }
+    }
+  }
+
+  Tour tour = head;
+  tour.insert(tour.end(),tail.begin(),tail.end());
+  if(evalTourCost(tour,flightCosts)<0) { return Tour(); }
+  return tour;
+}
+
+// segment-shift cost tables over a tour. moves like the double-bridge or the or-opt move whole segments of
+// the tour to a different day, so every leg inside the segment gets flown "shift" days later (or earlier).
+// costSums(shift+numCities,day) holds the total cost of the first "day" legs of the tour when each of them is
+// flown "shift" days later, and missingSums counts how many of those shifted legs have no flight. the cost of
+// a shifted segment is then a difference of two prefix sums along the shifted diagonal of flightCosts.
+// the rows are filled lazily, and when the tour changes, only the part of each row after the first changed day
+// is invalidated and gets recomputed on the next query that needs it.
+struct SegmentShiftCosts
+{
+  int numCities;
+  Array2<int> costSums;
+  Array2<int> missingSums;
+  std::vector<int> validUpTo; // for each shift, the sums are valid up to this day (inclusive)
+
+  SegmentShiftCosts() : numCities(0) {}
+  SegmentShiftCosts(int numCities) : numCities(numCities),costSums(2*numCities+1,numCities+1),missingSums(2*numCities+1,numCities+1),validUpTo(2*numCities+1,0)
+  {
+    for(int shift=-numCities;shift<=numCities;shift++)
+    {
+      costSums(shift+numCities,0) = 0;
+      missingSums(shift+numCities,0) = 0;
+    }
+  }
+};
+
+void updateSegmentShiftCosts(const Tour& oldTour,const Tour& newTour,SegmentShiftCosts* inout_shiftCosts)
+{
+  SegmentShiftCosts& shiftCosts = *inout_shiftCosts;
+
+  int firstChangedDay = 0;
+  while(firstChangedDay<newTour.size() && oldTour[firstChangedDay]==newTour[firstChangedDay]) { firstChangedDay++; }
+
+  // the legs up to day firstChangedDay-2 connect the same cities as before, so their sums are still valid
+  const int lastValidDay = std::max(firstChangedDay-1,0);
+  for(int i=0;i<shiftCosts.validUpTo.size();i++) { shiftCosts.validUpTo[i] = std::min(shiftCosts.validUpTo[i],lastValidDay); }
+}
+
+// the cost of the legs between tour[firstDay] and tour[lastDay] when each of them is flown "shift" days later,
+// or -1 when some of the shifted legs has no flight, walked leg by leg. used for the short segments, which are
+// cheaper to walk than to fill a row of the SegmentShiftCosts table for
+int walkShiftedSegmentCost(const Tour& tour,const int firstDay,const int lastDay,const int shift,const Array3<int>& flightCosts)
+{
+  int cost = 0;
+  for(int day=firstDay;day<lastDay;day++)
+  {
+    const int flightCost = flightCosts(day+shift,tour[day],tour[day+1]);
+    if(flightCost<0) { return -1; }
+    cost += flightCost;
+  }
+  return cost;
+}
+
+// returns the cost of the legs between tour[firstDay] and tour[lastDay] when each of them is flown "shift" days
+// later, or -1 when some of the shifted legs has no flight. without the tables, the segment is walked
+int evalShiftedSegmentCost(const Tour& tour,
+                           const int firstDay,
+                           const int lastDay,
+                           const int shift,
+                           const Array3<int>& flightCosts,
+                           SegmentShiftCosts* inout_shiftCosts)
+{
+  const int numCities = (inout_shiftCosts!=0) ? inout_shiftCosts->numCities : int(tour.size())-1;
+
+  if(firstDay+shift<0 || lastDay+shift>numCities) { return -1; }
+
+  if(inout_shiftCosts==0 || lastDay-firstDay<=4) { return walkShiftedSegmentCost(tour,firstDay,lastDay,shift,flightCosts); }
+
+  SegmentShiftCosts& shiftCosts = *inout_shiftCosts;
+
+  const int row = shift+numCities;
+  int& validUpTo = shiftCosts.validUpTo[row];
+
+  for(int day=validUpTo;day<lastDay;day++) // extend the row up to the last day of the segment
+  {
+    const int flightDay = day+shift;
+    const int cost = (flightDay>=0 && flightDay<numCities) ? flightCosts(flightDay,tour[day],tour[day+1]) : -1;
+
+    shiftCosts.costSums(row,day+1)    = shiftCosts.costSums(row,day)   +((cost>0) ? cost : 0);
+    shiftCosts.missingSums(row,day+1) = shiftCosts.missingSums(row,day)+((cost>0) ? 0 : 1);
+  }
+  validUpTo = std::max(validUpTo,lastDay);
+
+  if(shiftCosts.missingSums(row,lastDay)-shiftCosts.missingSums(row,firstDay)>0) { return -1; }
+
+  return shiftCosts.costSums(row,lastDay)-shiftCosts.costSums(row,firstDay);
+}
+
+// zobrist hashing of tours: zobristKeys(day,city) is a random 64-bit key of visiting the city on the day, and
+// the hash of a tour is the xor of the keys of all its days. a move only needs to update the days it changes.
+Array2<unsigned long long> zobristKeys;
+
+void makeZobristKeys(const int numCities)
+{
+  unsigned long long state = 0x9e3779b97f4a7c15ull;
+  zobristKeys = Array2<unsigned long long>(numCities+1,numCities);
+  for(int i=0;i<zobristKeys.numel();i++) // splitmix64
+  {
+    state += 0x9e3779b97f4a7c15ull;
+    unsigned long long z = state;
+    z = (z^(z>>30))*0xbf58476d1ce4e5b9ull;
+    z = (z^(z>>27))*0x94d049bb133111ebull;
+    zobristKeys[i] = z^(z>>31);
+  }
+}
+
+unsigned long long zobristHash(const Tour& tour)
+{
+  unsigned long long hash = 0;
+  for(int day=0;day<tour.size();day++) { hash ^= zobristKeys(day,tour[day]); }
+  return hash;
+}
+
+// updates the hash of oldTour to the hash of newTour, they may only differ on the days [firstDay,lastDay]
+unsigned long long updateZobristHash(const unsigned long long hash,const Tour& oldTour,const Tour& newTour,const int firstDay,const int lastDay)
+{
+  unsigned long long newHash = hash;
+  for(int day=firstDay;day<=lastDay;day++) { newHash ^= zobristKeys(day,oldTour[day])^zobristKeys(day,newTour[day]); }
+  return newHash;
+}
+
+// bounded set of tour hashes that can be shared by threads. it's a direct-mapped table, so a newer hash evicts
+// an older one that maps to the same slot, and both the lookup and the insertion are a single atomic access.
+struct HashSet
+{
+  std::vector<std::atomic<unsigned long long>> slots;
+  unsigned long long mask;
+
+  HashSet(int log2Size) : slots(1<<log2Size),mask((1ull<<log2Size)-1)
+  {
+    for(int i=0;i<slots.size();i++) { slots[i].store(0,std::memory_order_relaxed); }
+  }
+
+  bool contains(const unsigned long long hash) const { return slots[hash&mask].load(std::memory_order_relaxed)==hash; }
+  void insert(const unsigned long long hash)         { slots[hash&mask].store(hash,std::memory_order_relaxed); }
+};
+
+Tour doubleBridge(const Tour& tour,const int day1,const int day2,const int day3,const int day4)
+{
+  Tour newTour;
+  for(int i=0;i<day1;i++) { newTour.push_back(tour[i]); }
+  for(int i=day3;i<day4;i++) { newTour.push_back(tour[i]); }
+  for(int i=day2;i<day3;i++) { newTour.push_back(tour[i]); }
+  for(int i=day1;i<day2;i++) { newTour.push_back(tour[i]); }
+  for(int i=day4;i<tour.size();i++) { newTour.push_back(tour[i]); }
+  return newTour;
+}
+
+// exchanges the adjacent segments [day1,day2] and [day2+1,day3] without reversing either of them
+Tour exchangeSegments(const Tour& tour,const int day1,const int day2,const int day3)
+{
+  Tour newTour;
+  for(int i=0;i<day1;i++) { newTour.push_back(tour[i]); }
+  for(int i=day2+1;i<=day3;i++) { newTour.push_back(tour[i]); }
+  for(int i=day1;i<=day2;i++) { newTour.push_back(tour[i]); }
+  for(int i=day3+1;i<tour.size();i++) { newTour.push_back(tour[i]); }
+  return newTour;
+}
+
+// looks for an improving exchange of the segment [day1,day2] with the segment [day2+1,day3] that follows it,
+// where at least one of the two segments is at most maxShortLength cities long. the long segment is only
+// shifted by a few days, so its cost is accumulated leg by leg as it grows, and once one of its shifted legs
+// has no flight, all the longer segments are skipped. legCostSums[day] is the cost of the first "day" legs of
+// the tour. returns the change of the tour cost, or 0 when there's no improving exchange.
+int findImprovingSegmentExchange(const Tour& tour,
+                                 const std::vector<int>& legCostSums,
+                                 const int day1,
+                                 const int maxShortLength,
+                                 const Array3<int>& flightCosts,
+                                 int* out_day2,
+                                 int* out_day3)
+{
+  const int lastDay = tour.size()-2; // the last day a moved segment can end on
+
+  for(int lengthA=1;lengthA<=maxShortLength;lengthA++) // short first segment, long second segment
+  {
+    const int day2 = day1+lengthA-1;
+    if(day2>=lastDay) { break; }
+
+    const int joinCost1 = flightCosts(day1-1,tour[day1-1],tour[day2+1]);
+    if(joinCost1<0) { continue; }
+
+    int costB = 0;
+    for(int day3=day2+1;day3<=lastDay;day3++)
+    {
+      if(day3>day2+1)
+      {
+        const int flightCost = flightCosts(day3-1-lengthA,tour[day3-1],tour[day3]);
+        if(flightCost<0) { break; } // all the longer second segments contain this leg too
+        costB += flightCost;
+      }
+
+      const int lengthB = day3-day2;
+      const int joinCost2 = flightCosts(day1+lengthB-1,tour[day3],tour[day1]); if(joinCost2<0) { continue; }
+      const int joinCost3 = flightCosts(day3,tour[day2],tour[day3+1]);         if(joinCost3<0) { continue; }
+      const int costA = walkShiftedSegmentCost(tour,day1,day2,lengthB,flightCosts); if(costA<0) { continue; }
+
+      const int delta = (joinCost1+costB+joinCost2+costA+joinCost3)-(legCostSums[day3+1]-legCostSums[day1-1]);
+      if(delta<0) { *out_day2 = day2; *out_day3 = day3; return delta; }
+    }
+  }
+
+  for(int lengthB=1;lengthB<=maxShortLength;lengthB++) // long first segment, short second segment
+  {
+    int costA = 0;
+    for(int day2=day1;day2+lengthB<=lastDay;day2++)
+    {
+      if(day2>day1)
+      {
+        const int flightCost = flightCosts(day2-1+lengthB,tour[day2-1],tour[day2]);
+        if(flightCost<0) { break; } // all the longer first segments contain this leg too
+        costA += flightCost;
+      }
+
+      const int lengthA = day2-day1+1;
+      if(lengthA<=maxShortLength) { continue; } // already covered above
+
+      const int day3 = day2+lengthB;
+      const int joinCost1 = flightCosts(day1-1,tour[day1-1],tour[day2+1]);      if(joinCost1<0) { continue; }
+      const int joinCost2 = flightCosts(day1+lengthB-1,tour[day3],tour[day1]);  if(joinCost2<0) { continue; }
+      const int joinCost3 = flightCosts(day3,tour[day2],tour[day3+1]);          if(joinCost3<0) { continue; }
+      const int costB = walkShiftedSegmentCost(tour,day2+1,day3,-lengthA,flightCosts); if(costB<0) { continue; }
+
+      const int delta = (joinCost1+costB+joinCost2+costA+joinCost3)-(legCostSums[day3+1]-legCostSums[day1-1]);
+      if(delta<0) { *out_day2 = day2; *out_day3 = day3; return delta; }
+    }
+  }
+
+  return 0;
+}
+
+// evaluates the double-bridge move without building the new tour. the legs before day1 and after day4 keep
+// their days, and the three moved segments are only shifted to different days, so their costs come from the
+// segment-shift tables, when there are any. the four legs that join the segments are checked first and the
+// evaluation stops at the first missing flight or as soon as the running cost reaches costLimit. returns -1 in
+// that case, otherwise the cost of the new tour.
+int evalDoubleBridgeCost(const Tour& tour,
+                         const int day1,const int day2,const int day3,const int day4,
+                         const double costLimit,
+                         const Array3<int>& flightCosts,
+                         SegmentShiftCosts* inout_shiftCosts)
+{
+  const int numLegs = tour.size()-1;
+
+  // new order of the segments: [0,day1) [day3,day4) [day2,day3) [day1,day2) [day4,numLegs]
+  const int joinDay1 = day1-1;
+  const int joinDay2 = day1+(day4-day3)-1;
+  const int joinDay3 = day1+(day4-day2)-1;
+  const int joinDay4 = day4-1;
+
+  const int joinCost1 = flightCosts(joinDay1,tour[day1-1],tour[day3]); if(joinCost1<0) { return -1; }
+  const int joinCost2 = flightCosts(joinDay2,tour[day4-1],tour[day2]); if(joinCost2<0) { return -1; }
+  const int joinCost3 = flightCosts(joinDay3,tour[day3-1],tour[day1]); if(joinCost3<0) { return -1; }
+  const int joinCost4 = flightCosts(joinDay4,tour[day2-1],tour[day4]); if(joinCost4<0) { return -1; }
+
+  int cost = joinCost1+joinCost2+joinCost3+joinCost4;
+
+  const int prefixCost = evalShiftedSegmentCost(tour,0,day1-1,0,flightCosts,inout_shiftCosts);
+  const int suffixCost = evalShiftedSegmentCost(tour,day4,numLegs,0,flightCosts,inout_shiftCosts);
+  if(prefixCost<0 || suffixCost<0) { return -1; }
+  cost += prefixCost+suffixCost;
+  if(cost>=costLimit) { return -1; }
+
+  const int firstDay[3] = { day3,day2,day1 };
+  const int lastDay[3]  = { day4-1,day3-1,day2-1 };
+  const int shift[3]    = { day1-day3,day1+day4-day3-day2,day4-day2 };
+
+  for(int segment=0;segment<3;segment++)
+  {
+    const int segmentCost = evalShiftedSegmentCost(tour,firstDay[segment],lastDay[segment],shift[segment],flightCosts,inout_shiftCosts);
+    if(segmentCost<0) { return -1; }
+    cost += segmentCost;
+    if(cost>=costLimit) { return -1; }
+  }
+
+  return cost;
+}
+
+// shiftCosts are the segment-shift tables of the tour, they can be kept across calls as long as they're
+// updated when the tour changes. when no tables are given, the shifted segments are walked leg by leg, which
+// is cheaper than filling tables that are thrown away after one kick. the four kicked days lie
+// within maxSpan consecutive days, by default they can be anywhere in the tour. the kicked tours that are in
+// recentKicks are skipped, and the returned one is added to it.
+Tour restrictedDoubleBridgeKick(const Tour& tour,
+                                const Array3<int>& flightCosts,
+                                const double maxAllowedCostIncrease,
+                                const int maxIters=100,
+                                SegmentShiftCosts* inout_shiftCosts=0,
+                                const int maxSpan=INT_MAX,
+                                HashSet* inout_recentKicks=0)
+{
+  const int numDays = tour.size()-1; // the kicked days are drawn from [1,numDays]
+  const int span = std::max(std::min(maxSpan,numDays),std::min(7,numDays)); // the shortest span that fits a valid 4-tuple
+
+  const int originalCost = evalTourCost(tour,flightCosts);
+
+  for(int iter=0;iter<maxIters;iter++) // keep generating double-bridge moves until we find a valid one
+  {
+    int days[4];
+
+    while(1)
+    {
+      const int firstDay = 1+threadRandom(numDays-span+1);
+
+      for(int i=0;i<4;i++) // generate a 4-tuple of random non-repeating days
+      {
+      retry:
+        const int d = firstDay+threadRandom(span);
+        for(int j=0;j<i;j++) if(days[j]==d) { goto retry; }
+        days[i] = d;
+      }
+
+      std::sort(std::begin(days),std::end(days));
+
+      // there should be at least one extra day between each two consecutive days
+      if(days[1]>days[0]+1 &&
+          days[2]>days[1]+1 &&
+          days[3]>days[2]+1)
+      {
+        break; // accept the 4-tuple when this is satisfied. otherwise, generate a new one
+      }
+    }
+
+    const int cost = evalDoubleBridgeCost(tour,days[0],days[1],days[2],days[3],maxAllowedCostIncrease*originalCost,flightCosts,inout_shiftCosts);
+    if(cost>0)
+    {
+      const Tour kickTour = doubleBridge(tour,days[0],days[1],days[2],days[3]); // only the accepted kick gets materialized
+      if(inout_recentKicks!=0)
+      {
+        const unsigned long long hash = zobristHash(kickTour);
+        if(inout_recentKicks->contains(hash)) { continue; }
+        inout_recentKicks->insert(hash);
+      }
+      return kickTour;
+    }
+  }
+
+  return Tour();
+}
+
+enum AnnealingMove { ANNEALING_SWAP, ANNEALING_FLIP, ANNEALING_RELOCATE };
+
+// change of the tour cost when the move is applied to day1 and day2, or COST_MAX when some of the new legs
+// have no flight. only the legs affected by the move are visited. a relocation moves the city on day1 to day2
+// and shifts the cities in between by one day. the flight costs can be anything with the lookup of Array3<int>,
+// e.g. the penalized costs of the guided local search.
+template<typename FlightCosts>
+int evalAnnealingMoveDelta(const Tour& tour,
+                           const std::vector<int>& legCosts,
+                           const AnnealingMove move,
+                           const int day1,
+                           const int day2,
+                           const FlightCosts& flightCosts)
+{
+  const int* t = tour.data();
+  const int lo = std::min(day1,day2);
+  const int hi = std::max(day1,day2);
+
+  int oldCost = 0;
+  int newCost = 0;
+
+  // adds the cost of the new leg, returns false when it has no flight
+  const auto addLeg = [&](const int day,const int from,const int to)
+  {
+    const int flightCost = flightCosts(day,from,to);
+    newCost += flightCost;
+    return flightCost>=0;
+  };
+
+  if(move==ANNEALING_SWAP && hi>lo+1)
+  {
+    if(!addLeg(lo-1,t[lo-1],t[hi]) || !addLeg(lo,t[hi],t[lo+1]) ||
+       !addLeg(hi-1,t[hi-1],t[lo]) || !addLeg(hi,t[lo],t[hi+1])) { return COST_MAX; }
+    return newCost-(legCosts[lo-1]+legCosts[lo]+legCosts[hi-1]+legCosts[hi]);
+  }
+
+  if(move==ANNEALING_FLIP || move==ANNEALING_SWAP) // swapping two adjacent cities is a flip of length 2
+  {
+    if(!addLeg(lo-1,t[lo-1],t[hi])) { return COST_MAX; }
+    for(int day=lo;day<hi;day++) { if(!addLeg(day,t[hi-(day-lo)],t[hi-(day-lo)-1])) { return COST_MAX; } }
+    if(!addLeg(hi,t[lo],t[hi+1])) { return COST_MAX; }
+  }
+  else if(day2>day1)
+  {
+    if(!addLeg(day1-1,t[day1-1],t[day1+1])) { return COST_MAX; }
+    for(int day=day1+1;day<day2;day++) { if(!addLeg(day-1,t[day],t[day+1])) { return COST_MAX; } }
+    if(!addLeg(day2-1,t[day2],t[day1]) || !addLeg(day2,t[day1],t[day2+1])) { return COST_MAX; }
+  }
+  else
+  {
+    if(!addLeg(day2-1,t[day2-1],t[day1]) || !addLeg(day2,t[day1],t[day2])) { return COST_MAX; }
+    for(int day=day2;day<day1-1;day++) { if(!addLeg(day+1,t[day],t[day+1])) { return COST_MAX; } }
+    if(!addLeg(day1,t[day1-1],t[day1+1])) { return COST_MAX; }
+  }
+
+  for(int day=lo-1;day<=hi;day++) { oldCost += legCosts[day]; }
+  return newCost-oldCost;
+}
+
+template<typename FlightCosts>
+void applyAnnealingMove(const AnnealingMove move,const int day1,const int day2,const FlightCosts& flightCosts,Tour* inout_tour,std::vector<int>* inout_legCosts)
+{
+  Tour& tour = *inout_tour;
+  std::vector<int>& legCosts = *inout_legCosts;
+  const int lo = std::min(day1,day2);
+  const int hi = std::max(day1,day2);
+
+  if(move==ANNEALING_SWAP) { std::swap(tour[day1],tour[day2]); }
+  if(move==ANNEALING_FLIP) { std::reverse(tour.begin()+lo,tour.begin()+hi+1); }
+  if(move==ANNEALING_RELOCATE)
+  {
+    if(day2>day1) { std::rotate(tour.begin()+day1,tour.begin()+day1+1,tour.begin()+day2+1); }
+    else          { std::rotate(tour.begin()+day2,tour.begin()+day1,tour.begin()+day1+1); }
+  }
+
+  for(int day=lo-1;day<=hi;day++) { legCosts[day] = flightCosts(day,tour[day],tour[day+1]); }
+}
+
+// days whose moves have to be looked at (again). a descent starts with all of its days queued, and after a move
+// only the days next to the ones the move changed get queued again, so that the descent doesn't rescan the whole
+// tour after each improvement.
+struct DirtyDays
+{
+  std::vector<int> queue; // a ring buffer, a day is in it at most once
+  std::vector<unsigned char> isQueued;
+  int head;
+  int count;
+
+  DirtyDays(int numDays) : queue(numDays),isQueued(numDays,0),head(0),count(0) {}
+
+  void push(const int day)
+  {
+    if(isQueued[day]) { return; }
+    isQueued[day] = 1;
+    queue[(head+count)%queue.size()] = day;
+    count++;
+  }
+
+  void pushRange(const int firstDay,const int lastDay) // clamped to the days the queue holds
+  {
+    for(int day=std::max(0,firstDay);day<=std::min(int(queue.size())-1,lastDay);day++) { push(day); }
+  }
+
+  int pop()
+  {
+    const int day = queue[head];
+    head = (head+1)%queue.size();
+    count--;
+    isQueued[day] = 0;
+    return day;
+  }
+
+  bool empty() const { return count==0; }
+};
+
+enum ImprovementPolicy { FIRST_IMPROVEMENT, BEST_IMPROVEMENT };
+
+// 2-opt descent over the swaps and the flips (segment reversals) of the tour. the moves of a day with all the
+// other days are looked at when the day comes out of the DirtyDays queue, and either the first improving one or
+// the best one of them is applied, depending on the policy.
+template<typename FlightCosts>
+Tour perform2Opt(const Tour& initialTour,const FlightCosts& flightCosts,const ImprovementPolicy policy=FIRST_IMPROVEMENT)
+{
+  Tour tour = initialTour;
+  const int lastDay = tour.size()-2; // the last day a city can be moved to
+
+  std::vector<int> legCosts(tour.size()-1);
+  for(int day=0;day<tour.size()-1;day++) { legCosts[day] = flightCosts(day,tour[day],tour[day+1]); }
+
+  DirtyDays dirtyDays(lastDay+1);
+  dirtyDays.pushRange(1,lastDay-1);
+
+  while(!dirtyDays.empty())
+  {
+    checkTimeOut();
+
+    const int day1 = dirtyDays.pop();
+    if(day1<1 || day1>=lastDay) { continue; }
+
+    AnnealingMove bestMove = ANNEALING_SWAP;
+    int bestDay2 = -1;
+    int bestDelta = 0;
+
+    for(int day2=1;day2<=lastDay;day2++)
+    {
+      if(day2==day1) { continue; }
+
+      if(std::abs(day2-day1)>1) // swapping with the adjacent city is the flip of length 2
+      {
+        const int delta = evalAnnealingMoveDelta(tour,legCosts,ANNEALING_SWAP,day1,day2,flightCosts);
+        if(delta<bestDelta) { bestMove = ANNEALING_SWAP; bestDay2 = day2; bestDelta = delta; }
+      }
+
+      const int delta = evalAnnealingMoveDelta(tour,legCosts,ANNEALING_FLIP,day1,day2,flightCosts);
+      if(delta<bestDelta) { bestMove = ANNEALING_FLIP; bestDay2 = day2; bestDelta = delta; }
+
+      if(policy==FIRST_IMPROVEMENT && bestDay2>=0) { break; }
+    }
+
+    if(bestDay2<0) { continue; }
+
+    applyAnnealingMove(bestMove,day1,bestDay2,flightCosts,&tour,&legCosts);
+
+    if(bestMove==ANNEALING_SWAP)
+    {
+      dirtyDays.pushRange(day1-1,day1+1);
+      dirtyDays.pushRange(bestDay2-1,bestDay2+1);
+    }
+    else
+    {
+      dirtyDays.pushRange(std::min(day1,bestDay2)-1,std::max(day1,bestDay2)+1);
+    }
+  }
+
+  return tour; // the tour is now 2-opt
+}
+
+// position index of a tour, returns the day on which each city is visited (the start city maps to day 0)
+std::vector<int> makeDayOfCity(const Tour& tour)
+{
+  std::vector<int> dayOfCity(tour.size()-1);
+  for(int day=0;day<tour.size()-1;day++) { dayOfCity[tour[day]] = day; }
+  return dayOfCity;
+}
+
+void updateDontLookBits(const Tour& oldTour,const Tour& newTour,std::vector<int>* inout_dontLookBits)
+{
+  std::vector<int>& dontLookBits = *inout_dontLookBits;
+  const int numCities = oldTour.size()-1;
+  const int resetDepth = 3;
+  const std::vector<int> oldDayOfCity = makeDayOfCity(oldTour);
+  const std::vector<int> newDayOfCity = makeDayOfCity(newTour);
+  for(int city=0;city<numCities;city++)
+  {
+    const int oldTourSlot = oldDayOfCity[city];
+    const int newTourSlot = newDayOfCity[city];
+
+    if((oldTourSlot>0                && newTourSlot>0                && oldTour[oldTourSlot-1]!=newTour[newTourSlot-1]) ||
+       (oldTourSlot<oldTour.size()-1 && newTourSlot<newTour.size()-1 && oldTour[oldTourSlot+1]!=newTour[newTourSlot+1]))
+    {
+      for(int offset=-resetDepth;offset<=+resetDepth;offset++)
+      {
+        const int target = oldTourSlot+offset;
+        if(target>=0 && target<newTour.size())
+        {
+          dontLookBits[oldTour[target]] = 0;
+        }
+      }
+    }
+  }
+}
+
+// batched evaluation of the swap moves: for a fixed day1, findBestSwap evaluates swapping tour[day1] with
+// tour[day2] for all day2 in [day2Begin,day2End) and returns the day2 of the most improving swap, or -1 when
+// there's none. the days in the range have to be at least two days away from day1, so the legs around day1
+// and day2 don't overlap.
+// legCosts[day] is the cost of the tour's leg flown on the day. the AVX2 and AVX-512 kernels evaluate 8 and 16
+// candidates at once by gathering the four new legs from flightCosts, the kernel is selected at runtime.
+typedef int (*FindBestSwapKernel)(const Tour& tour,
+                                  const std::vector<int>& legCosts,
+                                  const int day1,
+                                  const int day2Begin,
+                                  const int day2End,
+                                  const Array3<int>& flightCosts,
+                                  int* out_delta);
+
+int findBestSwapScalar(const Tour& tour,
+                       const std::vector<int>& legCosts,
+                       const int day1,
+                       const int day2Begin,
+                       const int day2End,
+                       const Array3<int>& flightCosts,
+                       int* out_delta)
+{
+  const int city1 = tour[day1];
+  const int costFromTo1 = legCosts[day1-1]+legCosts[day1];
+
+  int bestDay2 = -1;
+  int bestDelta = 0;
+  for(int day2=day2Begin;day2<day2End;day2++)
+  {
+    const int city2 = tour[day2];
+
+    const int cost1 = flightCosts(day1-1,tour[day1-1],city2);
+    const int cost2 = flightCosts(day1  ,city2,tour[day1+1]);
+    const int cost3 = flightCosts(day2-1,tour[day2-1],city1);
+    const int cost4 = flightCosts(day2  ,city1,tour[day2+1]);
+
+    if(cost1>0 && cost2>0 && cost3>0 && cost4>0)
+    {
+      const int delta = (cost1+cost2+cost3+cost4)-(costFromTo1+legCosts[day2-1]+legCosts[day2]);
+      if(delta<bestDelta) { bestDelta = delta; bestDay2 = day2; }
+    }
+  }
+
+  if(out_delta!=0) { *out_delta = bestDelta; }
+  return bestDay2;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define SIMD_KERNELS
+  #define TARGET_AVX2   __attribute__((target("avx2")))
+  #define TARGET_AVX512 __attribute__((target("avx512f")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  #define SIMD_KERNELS
+  #define TARGET_AVX2
+  #define TARGET_AVX512
+#endif
+
+#ifdef SIMD_KERNELS
+
+TARGET_AVX2 int findBestSwapAVX2(const Tour& tour,
+                                 const std::vector<int>& legCosts,
+                                 const int day1,
+                                 const int day2Begin,
+                                 const int day2End,
+                                 const Array3<int>& flightCosts,
+                                 int* out_delta)
+{
+  // flightCosts(day,fromCity,toCity) lives at flightCosts[day+(fromCity+toCity*N)*N]
+  const int N = flightCosts.width();
+  const int NN = N*N;
+  const int* costs = flightCosts.data();
+  const int city1 = tour[day1];
+  const int costFromTo1 = legCosts[day1-1]+legCosts[day1];
+
+  const __m256i base1 = _mm256_set1_epi32((day1-1)+tour[day1-1]*N);
+  const __m256i base2 = _mm256_set1_epi32(day1+tour[day1+1]*NN);
+  const __m256i city1NN = _mm256_set1_epi32(city1*NN);
+  const __m256i city1N = _mm256_set1_epi32(city1*N);
+  const __m256i vN = _mm256_set1_epi32(N);
+  const __m256i vNN = _mm256_set1_epi32(NN);
+  const __m256i vCostFromTo1 = _mm256_set1_epi32(costFromTo1);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i lanes = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+
+  __m256i bestDelta = zero;
+  __m256i bestDay2 = _mm256_set1_epi32(-1);
+
+  int day2 = day2Begin;
+  for(;day2+8<=day2End;day2+=8)
+  {
+    const __m256i vDay2 = _mm256_add_epi32(_mm256_set1_epi32(day2),lanes);
+    const __m256i city2 = _mm256_loadu_si256((const __m256i*)&tour[day2]);
+    const __m256i prevCity2 = _mm256_loadu_si256((const __m256i*)&tour[day2-1]);
+    const __m256i nextCity2 = _mm256_loadu_si256((const __m256i*)&tour[day2+1]);
+
+    const __m256i index1 = _mm256_add_epi32(base1,_mm256_mullo_epi32(city2,vNN));
+    const __m256i index2 = _mm256_add_epi32(base2,_mm256_mullo_epi32(city2,vN));
+    const __m256i index3 = _mm256_add_epi32(_mm256_add_epi32(_mm256_sub_epi32(vDay2,_mm256_set1_epi32(1)),_mm256_mullo_epi32(prevCity2,vN)),city1NN);
+    const __m256i index4 = _mm256_add_epi32(_mm256_add_epi32(vDay2,city1N),_mm256_mullo_epi32(nextCity2,vNN));
+
+    const __m256i cost1 = _mm256_i32gather_epi32(costs,index1,4);
+    const __m256i cost2 = _mm256_i32gather_epi32(costs,index2,4);
+    const __m256i cost3 = _mm256_i32gather_epi32(costs,index3,4);
+    const __m256i cost4 = _mm256_i32gather_epi32(costs,index4,4);
+
+    const __m256i minCost = _mm256_min_epi32(_mm256_min_epi32(cost1,cost2),_mm256_min_epi32(cost3,cost4));
+    const __m256i feasible = _mm256_cmpgt_epi32(minCost,zero);
+
+    const __m256i oldCost = _mm256_add_epi32(vCostFromTo1,_mm256_add_epi32(_mm256_loadu_si256((const __m256i*)&legCosts[day2-1]),
+                                                                           _mm256_loadu_si256((const __m256i*)&legCosts[day2])));
+    const __m256i newCost = _mm256_add_epi32(_mm256_add_epi32(cost1,cost2),_mm256_add_epi32(cost3,cost4));
+    const __m256i delta = _mm256_sub_epi32(newCost,oldCost);
+
+    const __m256i better = _mm256_and_si256(feasible,_mm256_cmpgt_epi32(bestDelta,delta));
+    bestDelta = _mm256_blendv_epi8(bestDelta,delta,better);
+    bestDay2 = _mm256_blendv_epi8(bestDay2,vDay2,better);
+  }
+
+  int laneDelta[8];
+  int laneDay2[8];
+  _mm256_storeu_si256((__m256i*)laneDelta,bestDelta);
+  _mm256_storeu_si256((__m256i*)laneDay2,bestDay2);
+
+  int tailDelta = 0;
+  int resultDay2 = findBestSwapScalar(tour,legCosts,day1,day2,day2End,flightCosts,&tailDelta);
+  int resultDelta = tailDelta;
+  for(int i=0;i<8;i++)
+  {
+    if(laneDay2[i]>=0 && (laneDelta[i]<resultDelta || (laneDelta[i]==resultDelta && laneDay2[i]<resultDay2)))
+    {
+      resultDelta = laneDelta[i];
+      resultDay2 = laneDay2[i];
+    }
+  }
+
+  if(out_delta!=0) { *out_delta = resultDelta; }
+  return resultDay2;
+}
+
+TARGET_AVX512 int findBestSwapAVX512(const Tour& tour,
+                                     const std::vector<int>& legCosts,
+                                     const int day1,
+                                     const int day2Begin,
+                                     const int day2End,
+                                     const Array3<int>& flightCosts,
+                                     int* out_delta)
+{
+  const int N = flightCosts.width();
+  const int NN = N*N;
+  const int* costs = flightCosts.data();
+  const int city1 = tour[day1];
+  const int costFromTo1 = legCosts[day1-1]+legCosts[day1];
+
+  const __m512i base1 = _mm512_set1_epi32((day1-1)+tour[day1-1]*N);
+  const __m512i base2 = _mm512_set1_epi32(day1+tour[day1+1]*NN);
+  const __m512i city1NN = _mm512_set1_epi32(city1*NN);
+  const __m512i city1N = _mm512_set1_epi32(city1*N);
+  const __m512i vN = _mm512_set1_epi32(N);
+  const __m512i vNN = _mm512_set1_epi32(NN);
+  const __m512i vCostFromTo1 = _mm512_set1_epi32(costFromTo1);
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i lanes = _mm512_setr_epi32(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+
+  __m512i bestDelta = zero;
+  __m512i bestDay2 = _mm512_set1_epi32(-1);
+
+  int day2 = day2Begin;
+  for(;day2+16<=day2End;day2+=16)
+  {
+    const __m512i vDay2 = _mm512_add_epi32(_mm512_set1_epi32(day2),lanes);
+    const __m512i city2 = _mm512_loadu_si512((const void*)&tour[day2]);
+    const __m512i prevCity2 = _mm512_loadu_si512((const void*)&tour[day2-1]);
+    const __m512i nextCity2 = _mm512_loadu_si512((const void*)&tour[day2+1]);
+
+    const __m512i index1 = _mm512_add_epi32(base1,_mm512_mullo_epi32(city2,vNN));
+    const __m512i index2 = _mm512_add_epi32(base2,_mm512_mullo_epi32(city2,vN));
+    const __m512i index3 = _mm512_add_epi32(_mm512_add_epi32(_mm512_sub_epi32(vDay2,_mm512_set1_epi32(1)),_mm512_mullo_epi32(prevCity2,vN)),city1NN);
+    const __m512i index4 = _mm512_add_epi32(_mm512_add_epi32(vDay2,city1N),_mm512_mullo_epi32(nextCity2,vNN));
+
+    const __m512i cost1 = _mm512_i32gather_epi32(index1,costs,4);
+    const __m512i cost2 = _mm512_i32gather_epi32(index2,costs,4);
+    const __m512i cost3 = _mm512_i32gather_epi32(index3,costs,4);
+    const __m512i cost4 = _mm512_i32gather_epi32(index4,costs,4);
+
+    const __m512i minCost = _mm512_min_epi32(_mm512_min_epi32(cost1,cost2),_mm512_min_epi32(cost3,cost4));
+    const __mmask16 feasible = _mm512_cmpgt_epi32_mask(minCost,zero);
+
+    const __m512i oldCost = _mm512_add_epi32(vCostFromTo1,_mm512_add_epi32(_mm512_loadu_si512((const void*)&legCosts[day2-1]),
+                                                                           _mm512_loadu_si512((const void*)&legCosts[day2])));
+    const __m512i newCost = _mm512_add_epi32(_mm512_add_epi32(cost1,cost2),_mm512_add_epi32(cost3,cost4));
+    const __m512i delta = _mm512_sub_epi32(newCost,oldCost);
+
+    const __mmask16 better = _mm512_mask_cmpgt_epi32_mask(feasible,bestDelta,delta);
+    bestDelta = _mm512_mask_blend_epi32(better,bestDelta,delta);
+    bestDay2 = _mm512_mask_blend_epi32(better,bestDay2,vDay2);
+  }
+
+  int laneDelta[16];
+  int laneDay2[16];
+  _mm512_storeu_si512((void*)laneDelta,bestDelta);
+  _mm512_storeu_si512((void*)laneDay2,bestDay2);
+
+  int tailDelta = 0;
+  int resultDay2 = findBestSwapAVX2(tour,legCosts,day1,day2,day2End,flightCosts,&tailDelta);
+  int resultDelta = tailDelta;
+  for(int i=0;i<16;i++)
+  {
+    if(laneDay2[i]>=0 && (laneDelta[i]<resultDelta || (laneDelta[i]==resultDelta && laneDay2[i]<resultDay2)))
+    {
+      resultDelta = laneDelta[i];
+      resultDay2 = laneDay2[i];
+    }
+  }
+
+  if(out_delta!=0) { *out_delta = resultDelta; }
+  return resultDay2;
+}
+
+#endif
+
+bool cpuSupportsAVX2()
+{
+#if defined(SIMD_KERNELS) && defined(__GNUC__)
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#elif defined(SIMD_KERNELS) && defined(_MSC_VER)
+  int info[4];
+  __cpuid(info,1);
+  if(!(info[2]&(1<<27))) { return false; } // OSXSAVE
+  __cpuidex(info,7,0);
+  return (_xgetbv(0)&0x06)==0x06 && (info[1]&(1<<5));
+#else
+  return false;
+#endif
+}
+
+bool cpuSupportsAVX512()
+{
+#if defined(SIMD_KERNELS) && defined(__GNUC__)
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx512f");
+#elif defined(SIMD_KERNELS) && defined(_MSC_VER)
+  int info[4];
+  __cpuid(info,1);
+  if(!(info[2]&(1<<27))) { return false; } // OSXSAVE
+  __cpuidex(info,7,0);
+  return (_xgetbv(0)&0xe6)==0xe6 && (info[1]&(1<<16));
+#else
+  return false;
+#endif
+}
+
+// the SIMD kernels gather from flightCosts with 32-bit indices, which overflow once it holds more than INT_MAX
+// costs, i.e. from 1291 cities on
+bool gatherIndicesFit(const Array3<int>& flightCosts)
+{
+  return (long long)flightCosts.width()*flightCosts.height()*flightCosts.depth()<=INT_MAX;
+}
+
+// the gathers dominate both SIMD kernels and their throughput is the same for 8 and 16 lanes on the CPUs
+// we've measured, so the AVX2 kernel is preferred. run with --benchmark to compare the kernels.
+FindBestSwapKernel selectFindBestSwapKernel(const Array3<int>& flightCosts)
+{
+#ifdef SIMD_KERNELS
+  if(gatherIndicesFit(flightCosts))
+  {
+    if(cpuSupportsAVX2())   { return findBestSwapAVX2; }
+    if(cpuSupportsAVX512()) { return findBestSwapAVX512; }
+  }
+#endif
+  return findBestSwapScalar;
+}
+
+FindBestSwapKernel findBestSwap = findBestSwapScalar; // selected once the size of flightCosts is known
+
+// a block of tours in the structure-of-arrays layout: cities[day*capacity+i] is the city the i-th tour visits
+// on the day. the capacity is rounded up to a multiple of 16, so the SIMD kernels never need a scalar tail.
+struct TourBatch
+{
+  int numTours;
+  int capacity;
+  int tourLength;
+  std::vector<int> cities;
+
+  TourBatch(int maxTours,int tourLength) : numTours(0),capacity(((maxTours+15)/16)*16),tourLength(tourLength),cities(capacity*tourLength,0) {}
+};
+
+void addTourToBatch(const Tour& tour,TourBatch* inout_batch)
+{
+  TourBatch& batch = *inout_batch;
+  for(int day=0;day<batch.tourLength;day++) { batch.cities[day*batch.capacity+batch.numTours] = tour[day]; }
+  batch.numTours++;
+}
+
+Tour getTourFromBatch(const TourBatch& batch,const int index)
+{
+  Tour tour(batch.tourLength);
+  for(int day=0;day<batch.tourLength;day++) { tour[day] = batch.cities[day*batch.capacity+index]; }
+  return tour;
+}
+
+// evaluates the costs of all tours in the batch, the cost of a tour that is not valid is -1
+typedef void (*EvalTourCostsKernel)(const TourBatch& batch,const Array3<int>& flightCosts,int* out_costs);
+
+void evalTourCostsScalar(const TourBatch& batch,const Array3<int>& flightCosts,int* out_costs)
+{
+  for(int i=0;i<batch.numTours;i++)
+  {
+    int tourCost = 0;
+    for(int day=0;day<batch.tourLength-1;day++)
+    {
+      const int cost = flightCosts(day,batch.cities[day*batch.capacity+i],batch.cities[(day+1)*batch.capacity+i]);
+      if(cost>0) { tourCost += cost; } else { tourCost = -1; break; }
+    }
+    out_costs[i] = tourCost;
+  }
+}
+
+#ifdef SIMD_KERNELS
+
+TARGET_AVX2 void evalTourCostsAVX2(const TourBatch& batch,const Array3<int>& flightCosts,int* out_costs)
+{
+  const int N = flightCosts.width();
+  const __m256i vN = _mm256_set1_epi32(N);
+  const __m256i vNN = _mm256_set1_epi32(N*N);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i invalid = _mm256_set1_epi32(-1);
+  const int* costs = flightCosts.data();
+
+  for(int i=0;i<batch.numTours;i+=8)
+  {
+    __m256i tourCost = zero;
+    __m256i minCost = _mm256_set1_epi32(COST_MAX);
+    __m256i fromCity = _mm256_loadu_si256((const __m256i*)&batch.cities[i]);
+
+    for(int day=0;day<batch.tourLength-1;day++)
+    {
+      const __m256i toCity = _mm256_loadu_si256((const __m256i*)&batch.cities[(day+1)*batch.capacity+i]);
+      const __m256i index = _mm256_add_epi32(_mm256_set1_epi32(day),_mm256_add_epi32(_mm256_mullo_epi32(fromCity,vN),_mm256_mullo_epi32(toCity,vNN)));
+      const __m256i cost = _mm256_i32gather_epi32(costs,index,4);
+      tourCost = _mm256_add_epi32(tourCost,cost);
+      minCost = _mm256_min_epi32(minCost,cost);
+      fromCity = toCity;
+
+      if(_mm256_movemask_epi8(_mm256_cmpgt_epi32(minCost,zero))==0) { break; } // none of the tours is valid
+    }
+
+    const __m256i valid = _mm256_cmpgt_epi32(minCost,zero);
+    int laneCosts[8];
+    _mm256_storeu_si256((__m256i*)laneCosts,_mm256_blendv_epi8(invalid,tourCost,valid));
+    for(int j=0;j<8 && i+j<batch.numTours;j++) { out_costs[i+j] = laneCosts[j]; }
+  }
+}
+
+TARGET_AVX512 void evalTourCostsAVX512(const TourBatch& batch,const Array3<int>& flightCosts,int* out_costs)
+{
+  const int N = flightCosts.width();
+  const __m512i vN = _mm512_set1_epi32(N);
+  const __m512i vNN = _mm512_set1_epi32(N*N);
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i invalid = _mm512_set1_epi32(-1);
+  const int* costs = flightCosts.data();
+
+  for(int i=0;i<batch.numTours;i+=16)
+  {
+    __m512i tourCost = zero;
+    __m512i minCost = _mm512_set1_epi32(COST_MAX);
+    __m512i fromCity = _mm512_loadu_si512((const void*)&batch.cities[i]);
+
+    for(int day=0;day<batch.tourLength-1;day++)
+    {
+      const __m512i toCity = _mm512_loadu_si512((const void*)&batch.cities[(day+1)*batch.capacity+i]);
+      const __m512i index = _mm512_add_epi32(_mm512_set1_epi32(day),_mm512_add_epi32(_mm512_mullo_epi32(fromCity,vN),_mm512_mullo_epi32(toCity,vNN)));
+      const __m512i cost = _mm512_i32gather_epi32(index,costs,4);
+      tourCost = _mm512_add_epi32(tourCost,cost);
+      minCost = _mm512_min_epi32(minCost,cost);
+      fromCity = toCity;
+
+      if(_mm512_cmpgt_epi32_mask(minCost,zero)==0) { break; } // none of the tours is valid
+    }
+
+    const __mmask16 valid = _mm512_cmpgt_epi32_mask(minCost,zero);
+    int laneCosts[16];
+    _mm512_storeu_si512((void*)laneCosts,_mm512_mask_blend_epi32(valid,invalid,tourCost));
+    for(int j=0;j<16 && i+j<batch.numTours;j++) { out_costs[i+j] = laneCosts[j]; }
+  }
+}
+
+#endif
+
+EvalTourCostsKernel selectEvalTourCostsKernel(const Array3<int>& flightCosts)
+{
+#ifdef SIMD_KERNELS
+  if(gatherIndicesFit(flightCosts))
+  {
+    if(cpuSupportsAVX2())   { return evalTourCostsAVX2; }
+    if(cpuSupportsAVX512()) { return evalTourCostsAVX512; }
+  }
+#endif
+  return evalTourCostsScalar;
+}
+
+EvalTourCostsKernel evalTourCosts = evalTourCostsScalar; // selected once the size of flightCosts is known
+
+// the cheapest of numTries double-ended NN tours grown from random (day,city) pairs. the candidate tours are
+// collected and evaluated in batches.
+Tour makeBestDoubleEndedNNTour(const int startCity,
+                               const int numCities,
+                               const Array3<int>& flightCosts,
+                               const Array2<std::vector<CityCost>>& sortedOutboundFlights,
+                               const Array2<std::vector<CityCost>>& sortedInboundFlights,
+                               const int numTries)
+{
+  Tour bestTour;
+  int bestCost = COST_MAX;
+
+  TourBatch batch(64,numCities+1);
+  std::vector<int> costs(batch.capacity);
+  for(int iter=0;iter<numTries;iter++)
+  {
+    const int fromCity = 1+threadRandom(numCities-1);
+    const int fromDay  = 1+threadRandom(numCities-1);
+    const Tour tour = makeDoubleEndedNNTour(fromCity,fromDay,startCity,numCities,flightCosts,sortedOutboundFlights,sortedInboundFlights);
+    if(!tour.empty()) { addTourToBatch(tour,&batch); }
+
+    if(batch.numTours==batch.capacity || (iter==numTries-1 && batch.numTours>0))
+    {
+      evalTourCosts(batch,flightCosts,costs.data());
+      for(int i=0;i<batch.numTours;i++)
+      {
+        if(costs[i]>0 && costs[i]<bestCost)
+        {
+          bestCost = costs[i];
+          bestTour = getTourFromBatch(batch,i);
+        }
+      }
+      batch.numTours = 0;
+    }
+  }
+
+  return bestTour;
+}
+
+// 2-opt descent over the swaps, the flips and the exchanges of adjacent segments where one of them is short.
+// the days to look at come from a DirtyDays queue, which plays the role of don't-look bits: after a move, only
+// the days within resetDepth of the changed ones are queued again. the descent stops early when it reaches one of
+// the knownOptima, since it can't improve a local optimum anyway. the hash of the tour is updated incrementally
+// by the moves.
+Tour perform2OptWithDLBs(const Tour& initialTour,const Array3<int>& flightCosts,const HashSet* knownOptima=0,const ImprovementPolicy policy=FIRST_IMPROVEMENT)
+{
+  const int resetDepth = 3; // how far from a changed day the days get queued again
+
+  Tour tour = initialTour;
+  const int lastDay = tour.size()-2; // the last day a city can be moved to
+  unsigned long long hash = zobristHash(tour);
+
+  std::vector<int> legCosts(tour.size()-1);
+  std::vector<int> legCostSums(tour.size(),0);
+  for(int day=0;day<tour.size()-1;day++)
+  {
+    legCosts[day] = flightCosts(day,tour[day],tour[day+1]);
+    legCostSums[day+1] = legCostSums[day]+legCosts[day];
+  }
+
+  DirtyDays dirtyDays(lastDay+1);
+  dirtyDays.pushRange(1,lastDay-1);
+
+  while(!dirtyDays.empty())
+  {
+    checkTimeOut();
+
+    if(knownOptima!=0 && knownOptima->contains(hash)) { break; }
+
+    const int day1 = dirtyDays.pop();
+    if(day1<1 || day1>=lastDay) { continue; }
+
+    // the swaps with a non-adjacent city on either side, all day2 candidates are evaluated in a batch
+    int bestDelta = 0;
+    int bestDay2 = findBestSwap(tour,legCosts,day1,day1+2,tour.size()-1,flightCosts,&bestDelta);
+    AnnealingMove bestMove = ANNEALING_SWAP;
+    int bestDay3 = -1; // the end of the second segment of an exchange
+
+    if(policy==BEST_IMPROVEMENT || bestDay2<0)
+    {
+      int delta = 0;
+      const int day2 = findBestSwap(tour,legCosts,day1,1,day1-1,flightCosts,&delta);
+      if(delta<bestDelta) { bestDay2 = day2; bestDelta = delta; }
+    }
+
+    // the flips, the flip of length 2 swaps the adjacent cities
+    if(policy==BEST_IMPROVEMENT || bestDay2<0)
+    {
+      for(int day2=1;day2<=lastDay;day2++)
+      {
+        if(day2==day1) { continue; }
+        const int delta = evalAnnealingMoveDelta(tour,legCosts,ANNEALING_FLIP,day1,day2,flightCosts);
+        if(delta<bestDelta)
+        {
+          bestMove = ANNEALING_FLIP; bestDay2 = day2; bestDelta = delta;
+          if(policy==FIRST_IMPROVEMENT) { break; }
+        }
+      }
+    }
+
+    // exchange the segment starting at day1 with the segment that follows it, at least one of them is short
+    if(policy==BEST_IMPROVEMENT || bestDay2<0)
+    {
+      int day2 = -1;
+      int day3 = -1;
+      const int delta = findImprovingSegmentExchange(tour,legCostSums,day1,3,flightCosts,&day2,&day3);
+      if(delta<bestDelta) { bestDay2 = day2; bestDay3 = day3; bestDelta = delta; }
+    }
+
+    if(bestDay2<0) { continue; }
+
+    const int firstChangedDay = std::min(day1,bestDay2);
+    const int lastChangedDay = (bestDay3>=0) ? bestDay3 : std::max(day1,bestDay2);
+    const bool isSwap = (bestDay3<0 && bestMove==ANNEALING_SWAP);
+
+    for(int day=firstChangedDay;day<=lastChangedDay;day++) { if(!isSwap || day==day1 || day==bestDay2) { hash ^= zobristKeys(day,tour[day]); } }
+
+    if(bestDay3>=0)
+    {
+      tour = exchangeSegments(tour,day1,bestDay2,bestDay3);
+      for(int day=day1-1;day<=bestDay3;day++) { legCosts[day] = flightCosts(day,tour[day],tour[day+1]); }
+    }
+    else
+    {
+      applyAnnealingMove(bestMove,day1,bestDay2,flightCosts,&tour,&legCosts);
+    }
+
+    for(int day=firstChangedDay;day<=lastChangedDay;day++) { if(!isSwap || day==day1 || day==bestDay2) { hash ^= zobristKeys(day,tour[day]); } }
+    for(int day=firstChangedDay-1;day<tour.size()-1;day++) { legCostSums[day+1] = legCostSums[day]+legCosts[day]; }
+
+    if(isSwap)
+    {
+      dirtyDays.pushRange(day1-resetDepth,day1+resetDepth);
+      dirtyDays.pushRange(bestDay2-resetDepth,bestDay2+resetDepth);
+    }
+    else
+    {
+      dirtyDays.pushRange(firstChangedDay-resetDepth,lastChangedDay+resetDepth);
+    }
+  }
+
+  return tour; // the tour is now 2-opt
+}
+
+// one step of a variable-depth chain: the city on the chain's active day is moved to day2, either by swapping
+// it with the city there, by relocating it there (the cities in between shift by one day), or by reversing the
+// segment between the two days. in each case another city takes over the active day and gets moved next.
+struct ChainMove
+{
+  enum Type { Swap, Relocate, Reverse };
+
+  Type type;
+  int day2;
+  int delta; // change of the tour cost
+
+  ChainMove(Type type,int day2,int delta):type(type),day2(day2),delta(delta) {}
+  bool operator<(const ChainMove& other) const { return delta < other.delta; }
+};
+
+Tour applyChainMove(const Tour& tour,const int day1,const ChainMove& move)
+{
+  Tour newTour = tour;
+  if(move.type==ChainMove::Swap) { std::swap(newTour[day1],newTour[move.day2]); }
+  if(move.type==ChainMove::Relocate)
+  {
+    if(move.day2>day1) { std::rotate(newTour.begin()+day1,newTour.begin()+day1+1,newTour.begin()+move.day2+1); }
+    else               { std::rotate(newTour.begin()+move.day2,newTour.begin()+day1,newTour.begin()+day1+1); }
+  }
+  if(move.type==ChainMove::Reverse) { std::reverse(newTour.begin()+std::min(day1,move.day2),newTour.begin()+std::max(day1,move.day2)+1); }
+  return newTour;
+}
+
+// collects all the valid moves of the city on day1 whose replacement city is not locked. relocations are
+// evaluated incrementally as day2 moves away from day1, reversals are only tried up to maxReverseLength cities.
+// legCostSums[day] is the cost of the first "day" legs of the tour.
+void findChainMoves(const Tour& tour,
+                    const std::vector<int>& legCostSums,
+                    const int day1,
+                    const std::vector<char>& isLocked,
+                    const int maxReverseLength,
+                    const Array3<int>& flightCosts,
+                    std::vector<ChainMove>* out_moves)
+{
+  std::vector<ChainMove>& moves = *out_moves;
+  moves.clear();
+
+  const int lastDay = tour.size()-2; // the last day a city can be moved to
+  const int* t = tour.data();
+
+  // swap
+  for(int day2=1;day2<=lastDay;day2++)
+  {
+    if(day2==day1 || isLocked[t[day2]]) { continue; }
+
+    const int lo = std::min(day1,day2);
+    const int hi = std::max(day1,day2);
+    int newCost;
+    int oldCost;
+    if(hi==lo+1)
+    {
+      const int c1 = flightCosts(lo-1,t[lo-1],t[hi]); if(c1<0) { continue; }
+      const int c2 = flightCosts(lo,t[hi],t[lo]);     if(c2<0) { continue; }
+      const int c3 = flightCosts(hi,t[lo],t[hi+1]);   if(c3<0) { continue; }
+      newCost = c1+c2+c3;
+      oldCost = legCostSums[hi+1]-legCostSums[lo-1];
+    }
+    else
+    {
+      const int c1 = flightCosts(lo-1,t[lo-1],t[hi]); if(c1<0) { continue; }
+      const int c2 = flightCosts(lo,t[hi],t[lo+1]);   if(c2<0) { continue; }
+      const int c3 = flightCosts(hi-1,t[hi-1],t[lo]); if(c3<0) { continue; }
+      const int c4 = flightCosts(hi,t[lo],t[hi+1]);   if(c4<0) { continue; }
+      newCost = c1+c2+c3+c4;
+      oldCost = (legCostSums[lo+1]-legCostSums[lo-1])+(legCostSums[hi+1]-legCostSums[hi-1]);
+    }
+    moves.push_back(ChainMove(ChainMove::Swap,day2,newCost-oldCost));
+  }
+
+  // relocation to a later day, the cities in between are flown one day earlier
+  if(day1+2<=lastDay && !isLocked[t[day1+1]])
+  {
+    const int joinCost = flightCosts(day1-1,t[day1-1],t[day1+1]);
+    int shiftedCost = 0;
+    for(int day2=day1+2;day2<=lastDay && joinCost>=0;day2++)
+    {
+      const int flightCost = flightCosts(day2-2,t[day2-1],t[day2]);
+      if(flightCost<0) { break; } // all the later days shift this leg too
+      shiftedCost += flightCost;
+
+      const int c1 = flightCosts(day2-1,t[day2],t[day1]);  if(c1<0) { continue; }
+      const int c2 = flightCosts(day2,t[day1],t[day2+1]);  if(c2<0) { continue; }
+      const int delta = (joinCost+shiftedCost+c1+c2)-(legCostSums[day2+1]-legCostSums[day1-1]);
+      moves.push_back(ChainMove(ChainMove::Relocate,day2,delta));
+    }
+  }
+
+  // relocation to an earlier day, the cities in between are flown one day later
+  if(day1-2>=1 && !isLocked[t[day1-1]])
+  {
+    const int joinCost = flightCosts(day1,t[day1-1],t[day1+1]);
+    int shiftedCost = 0;
+    for(int day2=day1-2;day2>=1 && joinCost>=0;day2--)
+    {
+      const int flightCost = flightCosts(day2+1,t[day2],t[day2+1]);
+      if(flightCost<0) { break; } // all the earlier days shift this leg too
+      shiftedCost += flightCost;
+
+      const int c1 = flightCosts(day2-1,t[day2-1],t[day1]);  if(c1<0) { continue; }
+      const int c2 = flightCosts(day2,t[day1],t[day2]);      if(c2<0) { continue; }
+      const int delta = (joinCost+shiftedCost+c1+c2)-(legCostSums[day1+1]-legCostSums[day2-1]);
+      moves.push_back(ChainMove(ChainMove::Relocate,day2,delta));
+    }
+  }
+
+  // reversal of a segment that starts or ends on day1, two-city segments are covered by the swap
+  for(int length=3;length<=maxReverseLength;length++)
+  {
+    for(int side=0;side<2;side++)
+    {
+      const int lo = (side==0) ? day1 : day1-length+1;
+      const int hi = lo+length-1;
+      if(lo<1 || hi>lastDay) { continue; }
+      if(isLocked[t[(side==0) ? hi : lo]]) { continue; }
+
+      int cost = flightCosts(lo-1,t[lo-1],t[hi]);
+      if(cost<0) { continue; }
+      for(int day=lo;day<=hi && cost>=0;day++)
+      {
+        const int flightCost = (day<hi) ? flightCosts(day,t[hi-(day-lo)],t[hi-(day-lo)-1]) : flightCosts(hi,t[lo],t[hi+1]);
+        cost = (flightCost<0) ? -1 : cost+flightCost;
+      }
+      if(cost<0) { continue; }
+
+      moves.push_back(ChainMove(ChainMove::Reverse,(side==0) ? hi : lo,cost-(legCostSums[hi+1]-legCostSums[lo-1])));
+    }
+  }
+}
+
+// variable-depth search in the spirit of Lin-Kernighan. a chain starts by moving the city on day1 somewhere
+// else, then the city that took over day1 is moved, and so on, with each city moved at most once. the chain
+// is allowed to make the tour worse along the way, but only by less than the cost of the two legs around day1
+// that it started by breaking (the positive gain criterion), and the best tour seen along the chain is kept.
+// the first two levels of the chain backtrack over several of the best moves, deeper levels only follow the
+// best one. the chains are started from every day under don't-look bits, and the whole thing alternates with
+// perform2OptWithDLBs until neither of them improves the tour, or until the tour is one of the knownOptima.
+Tour performVariableDepthSearch(const Tour& initialTour,const Array3<int>& flightCosts,const HashSet* knownOptima=0)
+{
+  const int maxDepth = 8;
+  const int maxReverseLength = 8;
+  const int breadth[2] = { 5,3 };
+
+  struct Chain
+  {
+    const Array3<int>& flightCosts;
+    const int day1;
+    const int initialCost;
+    const int maxCostIncrease;
+
+    std::vector<char>& isLocked;
+    std::vector<std::vector<ChainMove>>& movesAtDepth;
+    std::vector<std::vector<int>>& legCostSumsAtDepth;
+
+    Tour bestTour;
+    int bestCost;
+
+    Chain(const Tour& tour,const int cost,const int day1,const Array3<int>& flightCosts,std::vector<char>& isLocked,std::vector<std::vector<ChainMove>>& movesAtDepth,std::vector<std::vector<int>>& legCostSumsAtDepth)
+      : flightCosts(flightCosts),day1(day1),initialCost(cost),
+        maxCostIncrease(flightCosts(day1-1,tour[day1-1],tour[day1])+flightCosts(day1,tour[day1],tour[day1+1])),
+        isLocked(isLocked),movesAtDepth(movesAtDepth),legCostSumsAtDepth(legCostSumsAtDepth),bestCost(cost) {}
+
+    void extend(const Tour& tour,const int cost,const int depth,const int maxDepth,const int maxReverseLength,const int* breadth)
+    {
+      std::vector<int>& legCostSums = legCostSumsAtDepth[depth];
+      for(int day=0;day<tour.size()-1;day++) { legCostSums[day+1] = legCostSums[day]+flightCosts(day,tour[day],tour[day+1]); }
+
+      std::vector<ChainMove>& moves = movesAtDepth[depth];
+      findChainMoves(tour,legCostSums,day1,isLocked,maxReverseLength,flightCosts,&moves);
+
+      const int numTries = std::min(int(moves.size()),depth<2 ? breadth[depth] : 1);
+      std::partial_sort(moves.begin(),moves.begin()+numTries,moves.end());
+
+      const int movedCity = tour[day1];
+      isLocked[movedCity] = 1;
+
+      for(int i=0;i<numTries;i++)
+      {
+        const ChainMove move = moves[i];
+        const int newCost = cost+move.delta;
+        if(newCost-initialCost>=maxCostIncrease) { break; } // the remaining moves are even worse
+
+        const Tour newTour = applyChainMove(tour,day1,move);
+        if(newCost<bestCost)
+        {
+          bestTour = newTour;
+          bestCost = newCost;
+        }
+
+        if(depth+1<maxDepth) { extend(newTour,newCost,depth+1,maxDepth,maxReverseLength,breadth); }
+
+        if(bestCost<initialCost) { break; } // found an improvement, no need to backtrack
+      }
+
+      isLocked[movedCity] = 0;
+    }
+  };
+
+  const int numCities = flightCosts.width();
+  std::vector<int> dontLookBits = std::vector<int>(numCities,0);
+  std::vector<char> isLocked = std::vector<char>(numCities,0);
+  std::vector<std::vector<ChainMove>> movesAtDepth(maxDepth);
+  std::vector<std::vector<int>> legCostSumsAtDepth(maxDepth,std::vector<int>(numCities+1,0));
+
+  Tour bestTour = perform2OptWithDLBs(initialTour,flightCosts,knownOptima);
+  int bestCost = evalTourCost(bestTour,flightCosts);
+
+  while(1)
+  {
+  from_scratch:
+    checkTimeOut();
+
+    if(knownOptima!=0 && knownOptima->contains(zobristHash(bestTour))) { break; }
+
+    for(int day1=1;day1<bestTour.size()-1;day1++)
+    {
+      if(dontLookBits[bestTour[day1]]==1) { continue; }
+
+      Chain chain(bestTour,bestCost,day1,flightCosts,isLocked,movesAtDepth,legCostSumsAtDepth);
+      chain.extend(bestTour,bestCost,0,maxDepth,maxReverseLength,breadth);
+
+      if(chain.bestCost<bestCost)
+      {
+        updateDontLookBits(bestTour,chain.bestTour,&dontLookBits);
+        bestTour = chain.bestTour;
+        bestCost = chain.bestCost;
+        goto from_scratch;
+      }
+
+      dontLookBits[bestTour[day1]] = 1;
+    }
+
+    // no chain improves the tour, give the plain 2-opt moves another chance before terminating
+    const Tour tour = perform2OptWithDLBs(bestTour,flightCosts,knownOptima);
+    const int cost = evalTourCost(tour,flightCosts);
+    if(cost<bestCost)
+    {
+      updateDontLookBits(bestTour,tour,&dontLookBits);
+      bestTour = tour;
+      bestCost = cost;
+      goto from_scratch;
+    }
+
+    break;
+  }
+
+  return bestTour;
+}
+
+// number of legs of tourA that are not flown by tourB, i.e. the days on which they fly between different cities
+int evalLegDistance(const Tour& tourA,const Tour& tourB)
+{
+  int distance = 0;
+  for(int day=0;day<tourA.size()-1;day++)
+  {
+    if(tourA[day]!=tourB[day] || tourA[day+1]!=tourB[day+1]) { distance++; }
+  }
+  return distance;
+}
+
+// a small set of distinct good tours. a tour whose hash is already in the pool is rejected, and a tour that
+// is closer than minDistance legs to some member competes with that member only, so that the pool doesn't
+// fill up with variants of one tour. otherwise the tour replaces the worst member once the pool is full.
+struct ElitePool
+{
+  struct Member
+  {
+    Tour tour;
+    int cost;
+    unsigned long long hash;
+  };
+
+  int capacity;
+  int minDistance;
+  std::vector<Member> members;
+
+  ElitePool(int capacity,int minDistance) : capacity(capacity),minDistance(minDistance) {}
+
+  bool add(const Tour& tour,const int cost) // returns true when the tour made it to the pool
+  {
+    Member member;
+    member.tour = tour;
+    member.cost = cost;
+    member.hash = zobristHash(tour);
+
+    for(int i=0;i<members.size();i++)
+    {
+      if(members[i].hash==member.hash) { return false; }
+    }
+
+    for(int i=0;i<members.size();i++)
+    {
+      if(evalLegDistance(members[i].tour,tour)<minDistance)
+      {
+        if(cost>=members[i].cost) { return false; }
+        members[i] = member;
+        return true;
+      }
+    }
+
+    if(members.size()<capacity) { members.push_back(member); return true; }
+
+    int worst = 0;
+    for(int i=1;i<members.size();i++) { if(members[i].cost>members[worst].cost) { worst = i; } }
+    if(cost>=members[worst].cost) { return false; }
+    members[worst] = member;
+    return true;
+  }
+};
+
+// walks from the initial tour towards the guiding tour by swaps, each of which moves one more city to the day
+// it's visited on in the guiding tour. the path is split into thirds, and the best valid tour within each third
+// is locally optimized by perform2OptWithDLBs. returns the best of the optimized tours that differ from both
+// ends, or an empty tour when there's none.
+Tour performPathRelinking(const Tour& initialTour,const Tour& guidingTour,const Array3<int>& flightCosts)
+{
+  Tour tour = initialTour;
+  std::vector<int> dayOfCity = makeDayOfCity(tour);
+
+  std::vector<int> daysToFix;
+  for(int day=1;day<tour.size()-1;day++) { if(tour[day]!=guidingTour[day]) { daysToFix.push_back(day); } }
+  for(int i=int(daysToFix.size())-1;i>0;i--) { std::swap(daysToFix[i],daysToFix[threadRandom(i+1)]); }
+
+  const int numParts = 3;
+  std::vector<Tour> bestTourOfPart(numParts);
+  std::vector<int> bestCostOfPart(numParts,COST_MAX);
+
+  for(int step=0;step+1<daysToFix.size();step++) // the last swap would give the guiding tour itself
+  {
+    const int day = daysToFix[step];
+    if(tour[day]==guidingTour[day]) { continue; } // fixed as a side effect of an earlier swap
+
+    const int otherDay = dayOfCity[guidingTour[day]];
+    std::swap(tour[day],tour[otherDay]);
+    dayOfCity[tour[day]] = day;
+    dayOfCity[tour[otherDay]] = otherDay;
+
+    const int part = (step*numParts)/daysToFix.size();
+    const int cost = evalTourCost(tour,flightCosts);
+    if(cost>0 && cost<bestCostOfPart[part])
+    {
+      bestTourOfPart[part] = tour;
+      bestCostOfPart[part] = cost;
+    }
+  }
+
+  Tour bestTour;
+  int bestCost = COST_MAX;
+  for(int part=0;part<numParts;part++)
+  {
+    if(bestTourOfPart[part].empty()) { continue; }
+
+    const Tour optimizedTour = perform2OptWithDLBs(bestTourOfPart[part],flightCosts);
+    if(optimizedTour==initialTour || optimizedTour==guidingTour) { continue; } // fell back to one of the ends
+
+    const int cost = evalTourCost(optimizedTour,flightCosts);
+    if(cost<bestCost)
+    {
+      bestTour = optimizedTour;
+      bestCost = cost;
+    }
+  }
+
+  return bestTour;
+}
+
+// online tuning of the iterated local search, in place of per-size constants. each kind of kick is a pair of
+// a cost limit and a span, and it's scored by an exponential moving average of the cost decrease it brought per
+// second spent on it, kick and re-optimization included. the kick kind with the best score is used most of the
+// time, and a random one otherwise, so that the scores keep up as the search moves on and the best kind changes;
+// between kinds with the same score, the one whose kicks got accepted more often goes first.
+// the cost limits are all multiples of one scale, which follows the acceptance ratio of the kicks: when many of
+// them improve the tour, the kicks get milder, when almost none do, they get bolder. only the kicks that were
+// found count, so the kick generator failing on missing flights doesn't loosen the limits.
+// the search is restarted when it has tried several times as many kicks as it takes per improvement at the
+// recent acceptance ratio, and it has been stuck for several times the typical time between improvements, but
+// only while there's at least as much time left as it has already been stuck. the restart kick's cost limit also
+// follows the scale.
+struct KickController
+{
+  struct KickKind
+  {
+    double costScaleMultiple; // the kind's cost limit is 1+costScaleMultiple*costScale
+    int span; // the kicked days lie within this many consecutive days
+    double score;
+    double numTried;    // exponentially decayed counts of the found kicks
+    double numAccepted;
+
+    double acceptanceRatio() const { return (numAccepted+1.0)/(numTried+2.0); }
+  };
+
+  std::vector<KickKind> kinds;
+  int current;
+  FastRandom random;
+
+  double costScale;
+  double acceptanceRatio;    // of all the found kicks, exponential moving average
+  int numKicksSinceImprovement;
+  int numFailedSearches;     // the kick searches in a row that found no kick
+
+  double timeOfLastImprovement;
+  double meanTimeBetweenImprovements; // exponential moving average
+
+  KickController(int numCities,double time,unsigned int seed) : current(0),random(seed),costScale(0.1),acceptanceRatio(0.1),numKicksSinceImprovement(0),
+    numFailedSearches(0),timeOfLastImprovement(time),meanTimeBetweenImprovements(0.5)
+  {
+    const double costScaleMultiples[4] = { 0.5,1.0,2.0,3.5 };
+    const int spans[2] = { numCities,std::min(std::max(8,numCities/4),numCities) };
+    for(int i=0;i<4;i++)
+    for(int j=0;j<2;j++)
+    {
+      KickKind kind;
+      kind.costScaleMultiple = costScaleMultiples[i];
+      kind.span = spans[j];
+      kind.score = 1e9; // untried kinds go first
+      kind.numTried = 0;
+      kind.numAccepted = 0;
+      kinds.push_back(kind);
+    }
+  }
+
+  int nextKind()
+  {
+    if(random(5)==0) { current = random(kinds.size()); return current; }
+
+    current = 0;
+    for(int i=1;i<kinds.size();i++)
+    {
+      const KickKind& kind = kinds[i];
+      const KickKind& best = kinds[current];
+      if(kind.score>best.score || (kind.score==best.score && kind.acceptanceRatio()>best.acceptanceRatio())) { current = i; }
+    }
+    return current;
+  }
+
+  double maxAllowedCostIncrease(const int kind) const { return 1.0+kinds[kind].costScaleMultiple*costScale; }
+  int span(const int kind) const { return kinds[kind].span; }
+
+  double restartCostIncrease() const { return 1.0+1.5*costScale; }
+
+  void update(const bool kickFound,const int costDecrease,const double kickTime,const double time)
+  {
+    const double targetAcceptanceRatio = 0.05;
+
+    const double gain = double(costDecrease)/std::max(kickTime,1e-3);
+    KickKind& kind = kinds[current];
+    kind.score = (kind.score>=1e9) ? gain : 0.9*kind.score+0.1*gain;
+
+    if(kickFound)
+    {
+      const bool accepted = costDecrease>0;
+      kind.numTried = 0.98*kind.numTried+1.0;
+      kind.numAccepted = 0.98*kind.numAccepted+(accepted ? 1.0 : 0.0);
+
+      acceptanceRatio = 0.99*acceptanceRatio+(accepted ? 0.01 : 0.0);
+      costScale *= (acceptanceRatio>targetAcceptanceRatio) ? 0.998 : 1.002;
+      costScale = std::min(std::max(costScale,0.01),0.5);
+      numFailedSearches = 0;
+    }
+    else // the cost limit is too tight for the tour, or its few feasible kicks were all tried recently
+    {
+      costScale = std::min(costScale*1.01,0.5);
+      numFailedSearches++;
+    }
+
+    numKicksSinceImprovement++;
+    if(costDecrease>0)
+    {
+      meanTimeBetweenImprovements = 0.8*meanTimeBetweenImprovements+0.2*(time-timeOfLastImprovement);
+      timeOfLastImprovement = time;
+      numKicksSinceImprovement = 0;
+    }
+  }
+
+  // a tour the kick searches keep failing on is left right away, however long the search has been stuck
+  bool shouldRestart(const double time,const double deadline) const
+  {
+    if(numFailedSearches>=50) { return true; }
+
+    const double timeStuck = time-timeOfLastImprovement;
+    const double kicksPerImprovement = 1.0/std::max(acceptanceRatio,1e-3);
+    return numKicksSinceImprovement>4.0*kicksPerImprovement && timeStuck>4.0*meanTimeBetweenImprovements && deadline-time>timeStuck;
+  }
+
+  void restarted(const double time)
+  {
+    timeOfLastImprovement = time;
+    numKicksSinceImprovement = 0;
+    numFailedSearches = 0;
+  }
+};
+
+// iterated local search: the current tour is perturbed by a double-bridge kick, re-optimized by the
+// variable-depth search, and the result replaces the current tour when it's better. the size and the cost limit
+// of the kicks, and the timing of the restarts are tuned by the KickController. the improved tours are collected
+// in an elite pool, and the search restarts from a path relinking between two of its members. runs until the
+// deadline (in seconds since timeStart) and keeps globalBestTour up to date.
+void iteratedLocalSearch(const Tour& initialTour,const Array3<int>& flightCosts,const double deadline)
+{
+  Tour tour = initialTour;
+  int cost = evalTourCost(tour,flightCosts);
+
+  SegmentShiftCosts shiftCosts(numCities); // kept in sync with the current tour, so that consecutive kicks can reuse them
+
+  KickController controller(numCities,elapsedTime(timeStart),threadRandom.next());
+
+  ElitePool elitePool(8,std::max(4,numCities/10)); // the restarts relink its members
+  elitePool.add(tour,cost);
+
+  HashSet knownOptima(16); // the tours the variable-depth search has ended in
+  HashSet recentKicks(16);
+  while(elapsedTime(timeStart)<deadline)
+  {
+    checkTimeOut();
+
+    if(controller.shouldRestart(elapsedTime(timeStart),deadline))
+    {
+      // relink two of the elite tours, or fall back to kicking the best tour while there's only one of them
+      Tour restartTour;
+      if(elitePool.members.size()>=2)
+      {
+        const int i = threadRandom(elitePool.members.size());
+        const int j = (i+1+threadRandom(elitePool.members.size()-1))%elitePool.members.size();
+        restartTour = performPathRelinking(elitePool.members[i].tour,elitePool.members[j].tour,flightCosts);
+      }
+      if(restartTour.empty())
+      {
+        restartTour = restrictedDoubleBridgeKick(getGlobalBestTour(),flightCosts,controller.restartCostIncrease(),2000);
+      }
+      if(!restartTour.empty())
+      {
+        updateSegmentShiftCosts(tour,restartTour,&shiftCosts);
+        tour = restartTour;
+        cost = evalTourCost(tour,flightCosts);
+        controller.restarted(elapsedTime(timeStart));
+      }
+    }
+
+    const double timeKickStart = elapsedTime(timeStart);
+    const int kind = controller.nextKind();
+
+    Tour kickTour = restrictedDoubleBridgeKick(tour,flightCosts,controller.maxAllowedCostIncrease(kind),2000,&shiftCosts,controller.span(kind),&recentKicks);
+    const bool kickFound = !kickTour.empty();
+
+    int costDecrease = 0;
+    if(kickFound)
+    {
+      kickTour = performVariableDepthSearch(kickTour,flightCosts,&knownOptima);
+      knownOptima.insert(zobristHash(kickTour));
+
+      const int kickCost = evalTourCost(kickTour,flightCosts);
+
+      if(kickCost<cost)
+      {
+        updateSegmentShiftCosts(tour,kickTour,&shiftCosts);
+        tour = kickTour;
+        costDecrease = cost-kickCost;
+        cost = kickCost;
+
+        elitePool.add(tour,cost);
+      }
+    }
+
+    controller.update(kickFound,costDecrease,elapsedTime(timeStart)-timeKickStart,elapsedTime(timeStart));
+
+    updateGlobalBest(tour,cost);
+  }
+}
+
+int numSearchThreads()
+{
+  return (maxSearchThreads>0) ? maxSearchThreads : std::max(1,int(std::thread::hardware_concurrency()));
+}
+
+// runs body(i) for all i in [0,numItems) on numSearchThreads() threads and returns once all of them are done. the
+// items are handed out to the threads one by one, so that the threads stay busy even when the items take
+// different time.
+template<typename F> void parallelFor(const int numItems,const F& body)
+{
+  const int numThreads = std::min(numItems,numSearchThreads());
+  if(numThreads<=1) { for(int i=0;i<numItems;i++) { body(i); } return; }
+
+  std::vector<unsigned int> seeds(numThreads);
+  for(int t=0;t<numThreads;t++) { seeds[t] = threadRandom.next(); }
+
+  std::atomic<int> nextItem(0);
+  std::vector<std::thread> threads;
+  for(int t=0;t<numThreads;t++)
+  {
+    threads.push_back(std::thread([&,t]()
+    {
+      threadRandom = FastRandom(seeds[t]);
+      for(int i=nextItem++;i<numItems;i=nextItem++) { body(i); }
+    }));
+  }
+  for(int t=0;t<numThreads;t++) { threads[t].join(); }
+}
+
+// threads that stay alive between the parallel loops they run, for the loops that repeat many times in a row,
+// where starting a new set of threads for each of them would take about as long as the loop itself. the loops
+// hand out the items like parallelFor, and the calling thread runs items too.
+struct ThreadTeam
+{
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable loopStarted;
+  std::condition_variable loopFinished;
+
+  std::function<void(int)> body;
+  int numItems;
+  std::atomic<int> nextItem;
+  int numLoops;   // a worker joins the loop when this changes
+  int numWorking; // the workers that haven't finished the loop yet
+  bool quitting;
+
+  ThreadTeam(const int numThreads) : numItems(0),nextItem(0),numLoops(0),numWorking(0),quitting(false)
+  {
+    for(int t=1;t<numThreads;t++)
+    {
+      const unsigned int seed = threadRandom.next();
+      threads.push_back(std::thread([this,seed]()
+      {
+        threadRandom = FastRandom(seed);
+        int numLoopsDone = 0;
+        while(1)
+        {
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+            loopStarted.wait(lock,[&]() { return quitting || numLoops!=numLoopsDone; });
+            if(quitting) { return; }
+            numLoopsDone = numLoops;
+          }
+          runItems();
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(--numWorking==0) { loopFinished.notify_one(); }
+          }
+        }
+      }));
+    }
+  }
+
+  ~ThreadTeam()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quitting = true;
+      loopStarted.notify_all();
+    }
+    for(int t=0;t<threads.size();t++) { threads[t].join(); }
+  }
+
+  void runItems()
+  {
+    for(int i=nextItem++;i<numItems;i=nextItem++) { body(i); }
+  }
+
+  // runs body(i) for all i in [0,numItems) and returns once all of them are done
+  template<typename F> void parallelFor(const int numItems,const F& body)
+  {
+    if(threads.empty()) { for(int i=0;i<numItems;i++) { body(i); } return; }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      this->body = [&body](const int i) { body(i); };
+      this->numItems = numItems;
+      nextItem = 0;
+      numWorking = threads.size();
+      numLoops++;
+      loopStarted.notify_all();
+    }
+    runItems();
+    std::unique_lock<std::mutex> lock(mutex);
+    loopFinished.wait(lock,[&]() { return numWorking==0; });
+  }
+};
+
+// blocks the threads that call wait() until all numThreads of them do. it can be waited on again right away.
+struct Barrier
+{
+  std::mutex mutex;
+  std::condition_variable allArrived;
+  int numThreads;
+  int numArrived;
+  int numRounds;
+
+  Barrier(const int numThreads) : numThreads(numThreads),numArrived(0),numRounds(0) {}
+
+  void wait()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    const int round = numRounds;
+    if(++numArrived==numThreads)
+    {
+      numArrived = 0;
+      numRounds++;
+      allArrived.notify_all();
+      return;
+    }
+    allArrived.wait(lock,[&]() { return numRounds!=round; });
+  }
+};
+
+// 2-opt descent with a parallel best-improvement scan. each scan splits the days1 among the threads, and every
+// thread finds the best swap and the best flip starting on each of its days. the improving moves are then taken
+// from the best one down, skipping those that touch a day within one of a day an already taken move changes, so
+// that the deltas of the taken moves stay independent and all of them get applied at once. the scans repeat
+// until none of the moves improves the tour. the scans run on one ThreadTeam, so the threads are only started once
+// per descent.
+Tour perform2OptParallel(const Tour& initialTour,const Array3<int>& flightCosts)
+{
+  struct Move
+  {
+    int delta;
+    AnnealingMove type;
+    int day1;
+    int day2;
+
+    bool operator<(const Move& other) const { return delta<other.delta; }
+  };
+
+  Tour tour = initialTour;
+  const int lastDay = tour.size()-2;
+  if(lastDay<3) { return tour; }
+
+  std::vector<int> legCosts(tour.size()-1);
+  std::vector<Move> bestMoveOfDay(lastDay+1);
+  std::vector<Move> moves;
+  std::vector<unsigned char> isTouched(tour.size());
+
+  const int numChunks = 4*numSearchThreads();
+
+  ThreadTeam team(numSearchThreads()); // the scans of the descent reuse the same threads
+
+  while(1)
+  {
+    checkTimeOut();
+
+    for(int day=0;day<tour.size()-1;day++) { legCosts[day] = flightCosts(day,tour[day],tour[day+1]); }
+
+    team.parallelFor(numChunks,[&](const int chunk)
+    {
+      for(int day1=1+chunk;day1<lastDay;day1+=numChunks) // interleaved, the early days have more day2s to scan
+      {
+        Move best = Move{0,ANNEALING_SWAP,-1,-1};
+
+        int swapDelta = 0;
+        const int swapDay2 = findBestSwap(tour,legCosts,day1,day1+2,tour.size()-1,flightCosts,&swapDelta);
+        if(swapDay2>=0) { best = Move{swapDelta,ANNEALING_SWAP,day1,swapDay2}; }
+
+        for(int day2=day1+1;day2<=lastDay;day2++)
+        {
+          const int delta = evalAnnealingMoveDelta(tour,legCosts,ANNEALING_FLIP,day1,day2,flightCosts);
+          if(delta<best.delta) { best = Move{delta,ANNEALING_FLIP,day1,day2}; }
+        }
+
+        bestMoveOfDay[day1] = best;
+      }
+    });
+
+    moves.clear();
+    for(int day1=1;day1<lastDay;day1++) { if(bestMoveOfDay[day1].delta<0) { moves.push_back(bestMoveOfDay[day1]); } }
+    if(moves.empty()) { break; }
+    std::sort(moves.begin(),moves.end());
+
+    std::fill(isTouched.begin(),isTouched.end(),0);
+    for(int i=0;i<moves.size();i++)
+    {
+      const Move& move = moves[i];
+
+      // the days the move changes, each with the days next to it
+      bool overlaps = false;
+      if(move.type==ANNEALING_SWAP)
+      {
+        for(int d=-1;d<=1;d++) { overlaps |= isTouched[move.day1+d] || isTouched[move.day2+d]; }
+      }
+      else
+      {
+        for(int day=move.day1-1;day<=move.day2+1;day++) { overlaps |= isTouched[day]; }
+      }
+      if(overlaps) { continue; }
+
+      if(move.type==ANNEALING_SWAP)
+      {
+        for(int d=-1;d<=1;d++) { isTouched[move.day1+d] = 1; isTouched[move.day2+d] = 1; }
+      }
+      else
+      {
+        for(int day=move.day1-1;day<=move.day2+1;day++) { isTouched[day] = 1; }
+      }
+
+      applyAnnealingMove(move.type,move.day1,move.day2,flightCosts,&tour,&legCosts);
+    }
+  }
+
+  return tour;
+}
+
+struct AnnealingStep
+{
+  AnnealingMove type;
+  int day1;
+  int day2;
+};
+
+// a random move of the annealing: swaps can pair any two days, flips and relocations are limited to segments
+// of at most maxSegmentLength days, so that their delta evaluation stays cheap
+AnnealingStep randomAnnealingStep(const int lastDay,const int maxSegmentLength,FastRandom* rng)
+{
+  FastRandom& random = *rng;
+
+  AnnealingStep step;
+  const int r = random(3);
+  step.type = (r==0) ? ANNEALING_SWAP : (r==1 ? ANNEALING_FLIP : ANNEALING_RELOCATE);
+  step.day1 = 1+random(lastDay);
+  do
+  {
+    if(step.type==ANNEALING_SWAP) { step.day2 = 1+random(lastDay); }
+    else                          { step.day2 = step.day1-maxSegmentLength+random(2*maxSegmentLength+1); }
+  }
+  while(step.day2<1 || step.day2>lastDay || step.day2==step.day1);
+  return step;
+}
+
+// one trajectory of the annealing: the current tour with the costs of its legs, and the best tour visited
+struct AnnealingReplica
+{
+  Tour tour;
+  std::vector<int> legCosts;
+  int cost;
+
+  Tour bestTour;
+  int bestCost;
+
+  FastRandom random;
+
+  AnnealingReplica(const Tour& initialTour,const Array3<int>& flightCosts,unsigned int seed) : tour(initialTour),legCosts(initialTour.size()-1),random(seed)
+  {
+    for(int day=0;day<tour.size()-1;day++) { legCosts[day] = flightCosts(day,tour[day],tour[day+1]); }
+    cost = evalTourCost(tour,flightCosts);
+    bestTour = tour;
+    bestCost = cost;
+  }
+};
+
+// changes of the tour cost of random uphill moves, they're used to calibrate the temperatures
+std::vector<int> sampleUphillDeltas(AnnealingReplica* replica,const int maxSegmentLength,const Array3<int>& flightCosts)
+{
+  const int lastDay = replica->tour.size()-2;
+
+  std::vector<int> uphillDeltas;
+  for(int i=0;i<10000 && uphillDeltas.size()<1000;i++)
+  {
+    const AnnealingStep step = randomAnnealingStep(lastDay,maxSegmentLength,&replica->random);
+    const int delta = evalAnnealingMoveDelta(replica->tour,replica->legCosts,step.type,step.day1,step.day2,flightCosts);
+    if(delta>0 && delta<COST_MAX) { uphillDeltas.push_back(delta); }
+  }
+  return uphillDeltas;
+}
+
+// temperature at which the given fraction of the sampled uphill moves would be accepted
+double temperatureForAcceptanceRate(const std::vector<int>& uphillDeltas,const double acceptanceRate)
+{
+  double lo = 1e-3;
+  double hi = 1e+6;
+  for(int i=0;i<60;i++)
+  {
+    const double T = std::sqrt(lo*hi);
+    double rate = 0;
+    for(int j=0;j<uphillDeltas.size();j++) { rate += std::exp(-double(uphillDeltas[j])/T); }
+    if(rate/double(uphillDeltas.size())<acceptanceRate) { lo = T; } else { hi = T; }
+  }
+  return std::sqrt(lo*hi);
+}
+
+// tries numSteps random moves at the temperature T and accepts them with the Metropolis criterion. doesn't
+// check the timeout, so it's safe to call from any thread.
+void performAnnealingSteps(const double T,const int numSteps,const int maxSegmentLength,const Array3<int>& flightCosts,AnnealingReplica* inout_replica)
+{
+  AnnealingReplica& replica = *inout_replica;
+  const int lastDay = replica.tour.size()-2;
+
+  for(int i=0;i<numSteps;i++)
+  {
+    const AnnealingStep step = randomAnnealingStep(lastDay,maxSegmentLength,&replica.random);
+    const int delta = evalAnnealingMoveDelta(replica.tour,replica.legCosts,step.type,step.day1,step.day2,flightCosts);
+    if(delta==COST_MAX) { continue; }
+
+    if(delta<=0 || replica.random.uniform()<std::exp(-double(delta)/T))
+    {
+      applyAnnealingMove(step.type,step.day1,step.day2,flightCosts,&replica.tour,&replica.legCosts);
+      replica.cost += delta;
+
+      if(replica.cost<replica.bestCost)
+      {
+        replica.bestTour = replica.tour;
+        replica.bestCost = replica.cost;
+      }
+    }
+  }
+}
+
+// the temperature range of the annealing. most of the sampled uphill moves are far more expensive than any move
+// the annealing gets to make near a local optimum, so the range is set by the cheapest tenth of them: at T0 half
+// of those are accepted, at T1 only a small fraction, so the search settles into a local optimum at the end
+void annealingTemperatureRange(std::vector<int> uphillDeltas,double* out_T0,double* out_T1)
+{
+  const double initialAcceptanceRate = 0.5;
+  const double finalAcceptanceRate = 0.01;
+
+  const int numLowDeltas = std::max(1,int(uphillDeltas.size())/10);
+  std::nth_element(uphillDeltas.begin(),uphillDeltas.begin()+numLowDeltas-1,uphillDeltas.end());
+  uphillDeltas.resize(numLowDeltas);
+
+  *out_T0 = temperatureForAcceptanceRate(uphillDeltas,initialAcceptanceRate);
+  *out_T1 = temperatureForAcceptanceRate(uphillDeltas,finalAcceptanceRate);
+}
+
+// puts the replica back on its best tour
+void restartFromBestTour(const Array3<int>& flightCosts,AnnealingReplica* inout_replica)
+{
+  AnnealingReplica& replica = *inout_replica;
+  replica.tour = replica.bestTour;
+  replica.cost = replica.bestCost;
+  for(int day=0;day<replica.tour.size()-1;day++) { replica.legCosts[day] = flightCosts(day,replica.tour[day],replica.tour[day+1]); }
+}
+
+const int annealingMaxSegmentLength = 32;
+const double annealingMaxDrift = 0.1; // the replica goes back to its best tour when it's this much more expensive
+
+// simulated annealing over the moves of the local search: swaps, flips and relocations. a move only visits
+// the legs it changes, so flips and relocations are limited to short segments while swaps can pair any two
+// days. the temperature falls geometrically over the time left until the deadline, over the range given by
+// annealingTemperatureRange. when the tour drifts too far above the best one, the annealing continues from the
+// best one. the best tour found is polished by the variable-depth search at the end. keeps globalBestTour up to
+// date.
+void simulatedAnnealing(const Tour& initialTour,const Array3<int>& flightCosts,const double deadline)
+{
+  if(initialTour.size()<4) { return; }
+
+  AnnealingReplica replica(initialTour,flightCosts,threadRandom.next());
+
+  const std::vector<int> uphillDeltas = sampleUphillDeltas(&replica,annealingMaxSegmentLength,flightCosts);
+  if(uphillDeltas.empty()) { return; }
+
+  double T0,T1;
+  annealingTemperatureRange(uphillDeltas,&T0,&T1);
+
+  const double timeAnnealStart = elapsedTime(timeStart);
+  const double timeAnnealEnd = timeAnnealStart+0.95*(deadline-timeAnnealStart); // leaves some time for the polishing
+
+  while(1)
+  {
+    checkTimeOut();
+    const double time = elapsedTime(timeStart);
+    if(time>=timeAnnealEnd) { break; }
+
+    const double T = T0*std::pow(T1/T0,(time-timeAnnealStart)/(timeAnnealEnd-timeAnnealStart));
+    performAnnealingSteps(T,4096,annealingMaxSegmentLength,flightCosts,&replica);
+    if(replica.cost>replica.bestCost*(1.0+annealingMaxDrift)) { restartFromBestTour(flightCosts,&replica); }
+
+    updateGlobalBest(replica.bestTour,replica.bestCost);
+  }
+
+  const Tour bestTour = performVariableDepthSearch(replica.bestTour,flightCosts);
+  const int bestCost = evalTourCost(bestTour,flightCosts);
+
+  updateGlobalBest(bestTour,bestCost);
+}
+
+// parallel tempering: a ladder of annealing replicas at fixed temperatures, spaced geometrically over the range
+// given by annealingTemperatureRange, with one replica per core. the replicas run independently for an epoch,
+// then the neighboring rungs of the ladder exchange their replicas with the Metropolis criterion
+// min(1,exp((1/T_cold-1/T_hot)*(cost_cold-cost_hot))), so good tours sink towards the cold end while the hot
+// end keeps exploring. every thread runs a fixed set of rungs and stays alive for the whole run, the threads only
+// meet at a Barrier at the end of each epoch, and the exchanges and the updates of globalBestTour happen on the
+// calling thread before the next epoch starts. the best tour is polished by the variable-depth search at the end.
+void parallelTempering(const Tour& initialTour,const Array3<int>& flightCosts,const double deadline)
+{
+  const int stepsPerEpoch = 32768;
+
+  if(initialTour.size()<4) { return; }
+
+  const int numReplicas = std::max(4,numSearchThreads());
+
+  std::vector<AnnealingReplica> replicas;
+  for(int i=0;i<numReplicas;i++) { replicas.push_back(AnnealingReplica(initialTour,flightCosts,threadRandom.next())); }
+
+  const std::vector<int> uphillDeltas = sampleUphillDeltas(&replicas[0],annealingMaxSegmentLength,flightCosts);
+  if(uphillDeltas.empty()) { return; }
+
+  double Thot,Tcold;
+  annealingTemperatureRange(uphillDeltas,&Thot,&Tcold);
+
+  std::vector<double> temperatures(numReplicas); // rung 0 is the coldest one
+  for(int rung=0;rung<numReplicas;rung++) { temperatures[rung] = Tcold*std::pow(Thot/Tcold,double(rung)/double(numReplicas-1)); }
+
+  std::vector<int> replicaOnRung(numReplicas);
+  for(int rung=0;rung<numReplicas;rung++) { replicaOnRung[rung] = rung; }
+
+  const double timeTemperingEnd = elapsedTime(timeStart)+0.95*(deadline-elapsedTime(timeStart)); // leaves some time for the polishing
+
+  const int numThreads = std::min(numReplicas,numSearchThreads());
+  Barrier barrier(numThreads);
+  bool done = false;
+
+  // thread 0 is the calling one, between the epochs it exchanges the replicas while the other threads wait
+  const auto runThread = [&](const int thread)
+  {
+    for(int epoch=0;;epoch++)
+    {
+      if(thread==0)
+      {
+        if(epoch>0)
+        {
+          for(int rung=epoch%2;rung+1<numReplicas;rung+=2) // even and odd pairs of rungs take turns
+          {
+            const AnnealingReplica& cold = replicas[replicaOnRung[rung]];
+            const AnnealingReplica& hot  = replicas[replicaOnRung[rung+1]];
+            const double exponent = (1.0/temperatures[rung]-1.0/temperatures[rung+1])*double(cold.cost-hot.cost);
+            if(exponent>=0 || threadRandom.uniform()<std::exp(exponent)) { std::swap(replicaOnRung[rung],replicaOnRung[rung+1]); }
+          }
+
+          for(int i=0;i<numReplicas;i++)
+          {
+            updateGlobalBest(replicas[i].bestTour,replicas[i].bestCost);
+          }
+        }
+
+        checkTimeOut();
+        done = elapsedTime(timeStart)>=timeTemperingEnd;
+      }
+      barrier.wait();
+      if(done) { break; }
+
+      for(int rung=thread;rung<numReplicas;rung+=numThreads)
+      {
+        performAnnealingSteps(temperatures[rung],stepsPerEpoch,annealingMaxSegmentLength,flightCosts,&replicas[replicaOnRung[rung]]);
+      }
+      barrier.wait();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for(int t=1;t<numThreads;t++) { threads.push_back(std::thread(runThread,t)); }
+  runThread(0);
+  for(int t=0;t<threads.size();t++) { threads[t].join(); }
+
+  const Tour bestTour = performVariableDepthSearch(getGlobalBestTour(),flightCosts);
+  const int bestCost = evalTourCost(bestTour,flightCosts);
+
+  updateGlobalBest(bestTour,bestCost);
+}
+
+// the penalties of the guided local search, indexed by the offset of the leg in flightCosts. only a few of the
+// legs ever get penalized, so they're kept in a hash table, and a bitmap by (day,fromCity) lets the lookups of
+// all the other legs skip it.
+struct LegPenalties
+{
+  int numCities;
+  std::vector<unsigned char> isFromPenalized; // some leg from the city on the day has a penalty
+  std::unordered_map<int,int> penalties;
+
+  LegPenalties(const int numCities) : numCities(numCities),isFromPenalized(numCities*numCities,0) {}
+
+  int operator()(const int day,const int fromCity,const int toCity,const Array3<int>& flightCosts) const
+  {
+    if(!isFromPenalized[day*numCities+fromCity]) { return 0; }
+    const std::unordered_map<int,int>::const_iterator penalty = penalties.find(&flightCosts(day,fromCity,toCity)-flightCosts.data());
+    return (penalty!=penalties.end()) ? penalty->second : 0;
+  }
+
+  void increment(const int day,const int fromCity,const int toCity,const Array3<int>& flightCosts)
+  {
+    isFromPenalized[day*numCities+fromCity] = 1;
+    penalties[&flightCosts(day,fromCity,toCity)-flightCosts.data()]++;
+  }
+};
+
+// the augmented costs of the guided local search: each leg costs lambda*penalty more than its flight. it has the
+// lookup of Array3<int>, so the descents can run on it in place of flightCosts.
+struct AugmentedFlightCosts
+{
+  const Array3<int>& flightCosts;
+  const LegPenalties& penalties;
+  int lambda;
+
+  AugmentedFlightCosts(const Array3<int>& flightCosts,const LegPenalties& penalties,int lambda) : flightCosts(flightCosts),penalties(penalties),lambda(lambda) {}
+
+  int operator()(const int day,const int fromCity,const int toCity) const
+  {
+    const int flightCost = flightCosts(day,fromCity,toCity);
+    return (flightCost<0) ? flightCost : flightCost+lambda*penalties(day,fromCity,toCity,flightCosts);
+  }
+};
+
+// guided local search. the descents run on AugmentedFlightCosts, which add lambda*penalty(day,fromCity,toCity) to
+// the flight costs. in each local optimum, the legs with the highest utility cost/(1+penalty) get their penalty
+// raised, which pushes the next descent away from the expensive legs that keep showing up. lambda is a fraction
+// of the average leg cost of the first local optimum. the best tour is polished by the variable-depth search at
+// the end. keeps globalBestTour up to date.
+void guidedLocalSearch(const Tour& initialTour,const Array3<int>& flightCosts,const double deadline)
+{
+  const double alpha = 1.0;
+
+  LegPenalties penalties(flightCosts.width());
+
+  const double timeGuidedEnd = elapsedTime(timeStart)+0.95*(deadline-elapsedTime(timeStart)); // leaves some time for the polishing
+
+  Tour tour = initialTour;
+  int lambda = 0;
+  while(elapsedTime(timeStart)<timeGuidedEnd)
+  {
+    checkTimeOut();
+
+    tour = perform2Opt(tour,AugmentedFlightCosts(flightCosts,penalties,lambda));
+    const int cost = evalTourCost(tour,flightCosts);
+
+    updateGlobalBest(tour,cost);
+
+    if(lambda==0) { lambda = std::max(1,int(alpha*double(cost)/double(tour.size()-1))); }
+
+    double maxUtility = -1;
+    std::vector<int> maxUtilityDays;
+    for(int day=0;day<tour.size()-1;day++)
+    {
+      const double utility = double(flightCosts(day,tour[day],tour[day+1]))/double(1+penalties(day,tour[day],tour[day+1],flightCosts));
+
+      if(utility>maxUtility) { maxUtility = utility; maxUtilityDays.clear(); }
+      if(utility==maxUtility) { maxUtilityDays.push_back(day); }
+    }
+
+    for(int i=0;i<maxUtilityDays.size();i++)
+    {
+      const int day = maxUtilityDays[i];
+      penalties.increment(day,tour[day],tour[day+1],flightCosts);
+    }
+  }
+
+  const Tour bestTour = performVariableDepthSearch(getGlobalBestTour(),flightCosts);
+  const int bestCost = evalTourCost(bestTour,flightCosts);
+
+  updateGlobalBest(bestTour,bestCost);
+}
+
+// tabu search over the swaps of any two days and the flips of short segments. the deltas of all the moves are
+// cached, and after a move only the deltas of the moves that touch some day next to a changed day get recomputed.
+// each iteration makes the best admissible move, even when it makes the tour worse. the tabu is by attribute:
+// a move that puts a city back on a day it was recently moved away from is only admissible when it leads to
+// a tour better than the best one found so far. when every valid move is tabu, the least bad one is made anyway.
+// after a while without improving on the best tour, the search goes back to it. the best tour is polished by the
+// variable-depth search at the end. keeps globalBestTour up to date.
+void tabuSearch(const Tour& initialTour,const Array3<int>& flightCosts,const double deadline)
+{
+  const int maxFlipLength = 8;
+  const int minTenure = 7;
+
+  const int lastDay = initialTour.size()-2; // the last day a city can be moved to
+  if(lastDay<3) { return; }
+
+  Tour tour = initialTour;
+  int cost = evalTourCost(tour,flightCosts);
+  std::vector<int> legCosts(tour.size()-1);
+  for(int day=0;day<tour.size()-1;day++) { legCosts[day] = flightCosts(day,tour[day],tour[day+1]); }
+
+  Tour bestTour = tour;
+  int bestCost = cost;
+
+  Array2<int> swapDeltas(lastDay+1,lastDay+1);      // swapDeltas(day1,day2) for day1<day2
+  Array2<int> flipDeltas(lastDay+1,maxFlipLength+1); // flipDeltas(firstDay,length) for lengths from 3 up
+  Array2<int> tabuUntil(lastDay+1,flightCosts.width()); // the iteration until which the city can't return to the day
+  for(int i=0;i<swapDeltas.numel();i++) { swapDeltas[i] = COST_MAX; }
+  for(int i=0;i<flipDeltas.numel();i++) { flipDeltas[i] = COST_MAX; }
+  for(int i=0;i<tabuUntil.numel();i++) { tabuUntil[i] = 0; }
+
+  // recomputes the deltas of the moves whose legs include a leg that starts or ends on the day
+  auto updateDeltasAround = [&](const int day)
+  {
+    for(int other=1;other<=lastDay;other++)
+    {
+      if(other==day) { continue; }
+      swapDeltas(std::min(day,other),std::max(day,other)) = evalAnnealingMoveDelta(tour,legCosts,ANNEALING_SWAP,day,other,flightCosts);
+    }
+
+    for(int length=3;length<=maxFlipLength;length++)
+    for(int firstDay=std::max(1,day-length);firstDay<=day+1;firstDay++)
+    {
+      const int lastFlipDay = firstDay+length-1;
+      if(lastFlipDay>lastDay) { break; }
+      flipDeltas(firstDay,length) = evalAnnealingMoveDelta(tour,legCosts,ANNEALING_FLIP,firstDay,lastFlipDay,flightCosts);
+    }
+  };
+
+  for(int day=1;day<=lastDay;day++) { updateDeltasAround(day); }
+
+  const double timeTabuEnd = elapsedTime(timeStart)+0.95*(deadline-elapsedTime(timeStart)); // leaves some time for the polishing
+
+  const int maxItersWithoutImprovement = std::max(100,2*lastDay);
+  int iterOfLastImprovement = 0;
+
+  for(int iter=1;;iter++)
+  {
+    if(iter%16==0)
+    {
+      checkTimeOut();
+      if(elapsedTime(timeStart)>=timeTabuEnd) { break; }
+    }
+
+    if(iter-iterOfLastImprovement>maxItersWithoutImprovement) // intensify around the best tour
+    {
+      tour = bestTour;
+      cost = bestCost;
+      for(int day=0;day<tour.size()-1;day++) { legCosts[day] = flightCosts(day,tour[day],tour[day+1]); }
+      for(int day=1;day<=lastDay;day++) { updateDeltasAround(day); }
+      iterOfLastImprovement = iter;
+    }
+
+    // the best admissible move, and the best tabu one in case every valid move is tabu
+    AnnealingMove moveType = ANNEALING_SWAP;
+    int moveDay1 = -1;
+    int moveDay2 = -1;
+    int moveDelta = COST_MAX;
+
+    AnnealingMove tabuMoveType = ANNEALING_SWAP;
+    int tabuMoveDay1 = -1;
+    int tabuMoveDay2 = -1;
+    int tabuMoveDelta = COST_MAX;
+
+    for(int day1=1;day1<=lastDay;day1++)
+    for(int day2=day1+1;day2<=lastDay;day2++)
+    {
+      const int delta = swapDeltas(day1,day2);
+      if(delta>=moveDelta) { continue; }
+
+      const bool isTabu = tabuUntil(day1,tour[day2])>iter || tabuUntil(day2,tour[day1])>iter;
+      if(isTabu && cost+delta>=bestCost)
+      {
+        if(delta<tabuMoveDelta) { tabuMoveType = ANNEALING_SWAP; tabuMoveDay1 = day1; tabuMoveDay2 = day2; tabuMoveDelta = delta; }
+        continue;
+      }
+
+      moveType = ANNEALING_SWAP; moveDay1 = day1; moveDay2 = day2; moveDelta = delta;
+    }
+
+    for(int length=3;length<=maxFlipLength;length++)
+    for(int firstDay=1;firstDay+length-1<=lastDay;firstDay++)
+    {
+      const int delta = flipDeltas(firstDay,length);
+      if(delta>=moveDelta) { continue; }
+
+      const int lastFlipDay = firstDay+length-1;
+      bool isTabu = false;
+      for(int day=firstDay;day<=lastFlipDay;day++) { isTabu |= tabuUntil(day,tour[firstDay+lastFlipDay-day])>iter; }
+      if(isTabu && cost+delta>=bestCost)
+      {
+        if(delta<tabuMoveDelta) { tabuMoveType = ANNEALING_FLIP; tabuMoveDay1 = firstDay; tabuMoveDay2 = lastFlipDay; tabuMoveDelta = delta; }
+        continue;
+      }
+
+      moveType = ANNEALING_FLIP; moveDay1 = firstDay; moveDay2 = lastFlipDay; moveDelta = delta;
+    }
+
+    if(moveDay1<0) // every valid move is tabu, the least bad of them is made
+    {
+      if(tabuMoveDay1<0) { break; } // no valid move at all
+      moveType = tabuMoveType; moveDay1 = tabuMoveDay1; moveDay2 = tabuMoveDay2; moveDelta = tabuMoveDelta;
+    }
+
+    const int firstChangedDay = std::min(moveDay1,moveDay2);
+    const int lastChangedDay = std::max(moveDay1,moveDay2);
+
+    const int tenure = minTenure+threadRandom(std::max(1,lastDay/10));
+    for(int day=firstChangedDay;day<=lastChangedDay;day++)
+    {
+      if(moveType==ANNEALING_FLIP || day==moveDay1 || day==moveDay2) { tabuUntil(day,tour[day]) = iter+tenure; }
+    }
+
+    applyAnnealingMove(moveType,moveDay1,moveDay2,flightCosts,&tour,&legCosts);
+    cost += moveDelta;
+
+    if(cost<bestCost)
+    {
+      bestTour = tour;
+      bestCost = cost;
+      iterOfLastImprovement = iter;
+
+      updateGlobalBest(bestTour,bestCost);
+    }
+
+    if(moveType==ANNEALING_SWAP)
+    {
+      for(int day=std::max(1,moveDay1-1);day<=std::min(lastDay,moveDay1+1);day++) { updateDeltasAround(day); }
+      for(int day=std::max(1,moveDay2-1);day<=std::min(lastDay,moveDay2+1);day++) { updateDeltasAround(day); }
+    }
+    else
+    {
+      for(int day=std::max(1,firstChangedDay-1);day<=std::min(lastDay,lastChangedDay+1);day++) { updateDeltasAround(day); }
+    }
+  }
+
+  bestTour = performVariableDepthSearch(bestTour,flightCosts);
+  bestCost = evalTourCost(bestTour,flightCosts);
+
+  updateGlobalBest(bestTour,bestCost);
+}
+
+// ruin-and-recreate large neighborhood search. each step takes a window of consecutive days, removes some of
+// its cities, and puts them back into the window one by one. the kept cities of the window stay in order, and
+// an insertion shifts every city after it by one day, so the insertion cost includes the change of the legs that
+// get flown a day later. the repaired tour is then locally optimized around the window. all the buffers live in
+// the per-thread LnsWorker, so the steps don't allocate.
+const int lnsMaxRemoved = 12;
+const int lnsMaxMoveLength = 8;        // the longest flip and relocation of the descent
+const int lnsMissingLegCost = 1000000; // a leg without a flight still gets a cost while the window is rebuilt
+
+struct LnsWorker
+{
+  Tour tour;
+  std::vector<int> legCosts;
+  int cost;
+
+  Tour bestTour;
+  int bestCost;
+
+  FastRandom random;
+
+  // scratch
+  Tour candidateTour;
+  std::vector<int> candidateLegCosts;
+  std::vector<int> removed;          // the cities taken out of the window
+  std::vector<int> window;           // the cities of the window being rebuilt, in order
+  std::vector<int> shiftDeltaSums;   // shiftDeltaSums[i] is the cost change when the window from i on moves a day later
+  std::vector<std::pair<int,int>> relatedness; // (relatedness,day) of the cities that can still be removed
+  std::vector<unsigned char> isRemoved; // by day
+  std::vector<int> dirtyDays;
+  std::vector<unsigned char> isDirty; // by day
+
+  LnsWorker(const Tour& initialTour,const Array3<int>& flightCosts,unsigned int seed) : tour(initialTour),legCosts(initialTour.size()-1),random(seed),
+    candidateTour(initialTour),candidateLegCosts(initialTour.size()-1),isRemoved(initialTour.size(),0),isDirty(initialTour.size(),0)
+  {
+    for(int day=0;day<tour.size()-1;day++) { legCosts[day] = flightCosts(day,tour[day],tour[day+1]); }
+    cost = evalTourCost(tour,flightCosts);
+    bestTour = tour;
+    bestCost = cost;
+
+    removed.reserve(lnsMaxRemoved);
+    window.reserve(initialTour.size());
+    shiftDeltaSums.reserve(initialTour.size()+1);
+    relatedness.reserve(initialTour.size());
+    dirtyDays.reserve(initialTour.size());
+  }
+};
+
+inline int evalLnsLegCost(const int day,const int fromCity,const int toCity,const Array3<int>& flightCosts)
+{
+  const int flightCost = flightCosts(day,fromCity,toCity);
+  return (flightCost<0) ? lnsMissingLegCost : flightCost;
+}
+
+// removes numRemoved cities from the days [firstDay,lastDay] of the candidate tour. related removal grows the
+// removed set from a random seed city: a city is related to a removed one when there's a cheap leg between them
+// on the days next to where either of them is visited, and the next city is drawn with a bias towards the most
+// related ones. random removal picks any of the days. fills worker.removed and worker.window.
+void ruinWindow(const int firstDay,const int lastDay,const int numRemoved,const bool related,const Array3<int>& flightCosts,LnsWorker* inout_worker)
+{
+  LnsWorker& worker = *inout_worker;
+  const Tour& tour = worker.candidateTour;
+  const int windowLength = lastDay-firstDay+1;
+
+  worker.removed.clear();
+  for(int day=firstDay;day<=lastDay;day++) { worker.isRemoved[day] = 0; }
+
+  const int seedDay = firstDay+worker.random(windowLength);
+  worker.isRemoved[seedDay] = 1;
+  worker.removed.push_back(seedDay);
+
+  while(worker.removed.size()<numRemoved)
+  {
+    worker.relatedness.clear();
+
+    if(related)
+    {
+      const int dayA = worker.removed[worker.random(worker.removed.size())];
+      const int cityA = tour[dayA];
+      for(int dayB=firstDay;dayB<=lastDay;dayB++)
+      {
+        if(worker.isRemoved[dayB]) { continue; }
+        const int cityB = tour[dayB];
+        int cheapestLeg = lnsMissingLegCost;
+        const int days[4] = { dayA-1,dayA,dayB-1,dayB };
+        for(int i=0;i<4;i++)
+        {
+          const int ab = flightCosts(days[i],cityA,cityB);
+          const int ba = flightCosts(days[i],cityB,cityA);
+          if(ab>=0) { cheapestLeg = std::min(cheapestLeg,ab); }
+          if(ba>=0) { cheapestLeg = std::min(cheapestLeg,ba); }
+        }
+        worker.relatedness.push_back(std::make_pair(cheapestLeg,dayB));
+      }
+      std::sort(worker.relatedness.begin(),worker.relatedness.end());
+
+      const double u = worker.random.uniform();
+      const int day = worker.relatedness[int(u*u*u*worker.relatedness.size())].second;
+      worker.isRemoved[day] = 1;
+      worker.removed.push_back(day);
+    }
+    else
+    {
+      int day = firstDay+worker.random(windowLength);
+      while(worker.isRemoved[day]) { day = (day<lastDay) ? day+1 : firstDay; }
+      worker.isRemoved[day] = 1;
+      worker.removed.push_back(day);
+    }
+  }
+
+  for(int i=0;i<worker.removed.size();i++) { worker.removed[i] = tour[worker.removed[i]]; } // days to cities
+
+  worker.window.clear();
+  for(int day=firstDay;day<=lastDay;day++) { if(!worker.isRemoved[day]) { worker.window.push_back(tour[day]); } }
+}
+
+// puts the removed cities back into the window of the candidate tour. the partial window is laid out from
+// firstDay on, and inserting a city at index i moves the cities from i on a day later. the cost of the leg from
+// the end of the window to the rest of the tour is only known once the window is full, so it's counted in the
+// last insertion. with regret insertion, the city whose best insertion is the most ahead of its second best one
+// goes first, otherwise the city with the cheapest insertion does. returns false when the rebuilt window has
+// a leg without a flight.
+bool recreateWindow(const int firstDay,const int lastDay,const bool regret,const Array3<int>& flightCosts,LnsWorker* inout_worker)
+{
+  LnsWorker& worker = *inout_worker;
+  Tour& tour = worker.candidateTour;
+  std::vector<int>& window = worker.window;
+  const int windowLength = lastDay-firstDay+1;
+
+  while(!worker.removed.empty())
+  {
+    const int m = window.size();
+
+    worker.shiftDeltaSums.resize(m+1);
+    worker.shiftDeltaSums[m] = 0;
+    if(m>0) { worker.shiftDeltaSums[m-1] = 0; }
+    for(int j=m-2;j>=0;j--)
+    {
+      worker.shiftDeltaSums[j] = worker.shiftDeltaSums[j+1]+evalLnsLegCost(firstDay+j+1,window[j],window[j+1],flightCosts)
+                                                            -evalLnsLegCost(firstDay+j  ,window[j],window[j+1],flightCosts);
+    }
+
+    const bool lastInsertion = (m+1==windowLength);
+
+    int pickedIndex = -1;
+    int pickedPosition = -1;
+    int pickedCost = INT_MAX;
+    int pickedRegret = -1;
+
+    for(int r=0;r<worker.removed.size();r++)
+    {
+      const int city = worker.removed[r];
+      int bestCost = INT_MAX;
+      int secondCost = INT_MAX;
+      int bestPosition = -1;
+
+      for(int i=0;i<=m;i++)
+      {
+        const int prevCity = (i==0) ? tour[firstDay-1] : window[i-1];
+        int cost = evalLnsLegCost(firstDay+i-1,prevCity,city,flightCosts)+worker.shiftDeltaSums[i];
+        if(i<m) { cost += evalLnsLegCost(firstDay+i,city,window[i],flightCosts)-evalLnsLegCost(firstDay+i-1,prevCity,window[i],flightCosts); }
+        if(lastInsertion) { cost += evalLnsLegCost(lastDay,(i<m) ? window[m-1] : city,tour[lastDay+1],flightCosts); }
+
+        if(cost<bestCost) { secondCost = bestCost; bestCost = cost; bestPosition = i; }
+        else if(cost<secondCost) { secondCost = cost; }
+      }
+
+      const int regretValue = (secondCost==INT_MAX) ? INT_MAX : secondCost-bestCost;
+      const bool better = regret ? (regretValue>pickedRegret || (regretValue==pickedRegret && bestCost<pickedCost))
+                                 : (bestCost<pickedCost);
+      if(better)
+      {
+        pickedIndex = r;
+        pickedPosition = bestPosition;
+        pickedCost = bestCost;
+        pickedRegret = regretValue;
+      }
+    }
+
+    window.insert(window.begin()+pickedPosition,worker.removed[pickedIndex]); // within the reserved capacity
+    worker.removed[pickedIndex] = worker.removed.back();
+    worker.removed.pop_back();
+  }
+
+  for(int i=0;i<windowLength;i++) { tour[firstDay+i] = window[i]; }
+
+  for(int day=firstDay-1;day<=lastDay;day++)
+  {
+    worker.candidateLegCosts[day] = flightCosts(day,tour[day],tour[day+1]);
+    if(worker.candidateLegCosts[day]<0) { return false; }
+  }
+
+  return true;
+}
+
+// descent around the rebuilt window: the days waiting to be looked at are kept in a queue, and a day is only
+// queued again when a move changes one of the legs next to it. for each queued day, the best of the swaps with
+// any other day and the short flips and relocations that start or end on it is applied when it's improving.
+// returns the change of the cost.
+int descendAroundWindow(const int firstDay,const int lastDay,const Array3<int>& flightCosts,LnsWorker* inout_worker)
+{
+  LnsWorker& worker = *inout_worker;
+  Tour& tour = worker.candidateTour;
+  std::vector<int>& legCosts = worker.candidateLegCosts;
+  const int lastTourDay = tour.size()-2;
+
+  worker.dirtyDays.clear();
+  for(int day=std::max(1,firstDay-1);day<=std::min(lastTourDay,lastDay+1);day++)
+  {
+    worker.dirtyDays.push_back(day);
+    worker.isDirty[day] = 1;
+  }
+
+  int totalDelta = 0;
+
+  while(!worker.dirtyDays.empty())
+  {
+    const int day = worker.dirtyDays.back();
+    worker.dirtyDays.pop_back();
+    worker.isDirty[day] = 0;
+
+    AnnealingMove bestMove = ANNEALING_SWAP;
+    int bestDay1 = -1;
+    int bestDay2 = -1;
+    int bestDelta = 0;
+
+    for(int other=1;other<=lastTourDay;other++)
+    {
+      if(other==day) { continue; }
+      const int delta = evalAnnealingMoveDelta(tour,legCosts,ANNEALING_SWAP,day,other,flightCosts);
+      if(delta<bestDelta) { bestMove = ANNEALING_SWAP; bestDay1 = day; bestDay2 = other; bestDelta = delta; }
+    }
+
+    for(int length=2;length<=lnsMaxMoveLength;length++)
+    {
+      const int others[2] = { day-length+1,day+length-1 };
+      for(int i=0;i<2;i++)
+      {
+        if(others[i]<1 || others[i]>lastTourDay) { continue; }
+
+        if(length>2)
         {
-          const int city2 = bestTour[day2];
+          const int delta = evalAnnealingMoveDelta(tour,legCosts,ANNEALING_FLIP,day,others[i],flightCosts);
+          if(delta<bestDelta) { bestMove = ANNEALING_FLIP; bestDay1 = day; bestDay2 = others[i]; bestDelta = delta; }
+        }
+
+        const int delta = evalAnnealingMoveDelta(tour,legCosts,ANNEALING_RELOCATE,day,others[i],flightCosts);
+        if(delta<bestDelta) { bestMove = ANNEALING_RELOCATE; bestDay1 = day; bestDay2 = others[i]; bestDelta = delta; }
+      }
+    }
+
+    if(bestDay1<0) { continue; }
+
+    applyAnnealingMove(bestMove,bestDay1,bestDay2,flightCosts,&tour,&legCosts);
+    totalDelta += bestDelta;
+
+    const int lo = std::min(bestDay1,bestDay2);
+    const int hi = std::max(bestDay1,bestDay2);
+    for(int d=std::max(1,lo-1);d<=std::min(lastTourDay,hi+1);d++)
+    {
+      if(bestMove==ANNEALING_SWAP && d>lo+1 && d<hi-1) { continue; } // a swap leaves the days in between alone
+      if(!worker.isDirty[d]) { worker.dirtyDays.push_back(d); worker.isDirty[d] = 1; }
+    }
+  }
+
+  return totalDelta;
+}
+
+// one ruin-and-recreate step on the worker's tour. the candidate is accepted when it's not worse than the
+// worker's best tour by more than the given fraction (record-to-record travel). returns the candidate's cost,
+// or COST_MAX when no valid candidate came out of the step.
+int performLnsStep(const double maxDeviation,const Array3<int>& flightCosts,LnsWorker* inout_worker)
+{
+  LnsWorker& worker = *inout_worker;
+  const int lastTourDay = worker.tour.size()-2;
+
+  const int maxRemoved = std::min(lnsMaxRemoved,lastTourDay/2);
+  const int numRemoved = 2+worker.random(maxRemoved-1);
+  const int windowLength = std::min(lastTourDay,4*numRemoved);
+  const int firstDay = 1+worker.random(lastTourDay-windowLength+1);
+  const int lastDay = firstDay+windowLength-1;
+
+  std::copy(worker.tour.begin(),worker.tour.end(),worker.candidateTour.begin());
+  std::copy(worker.legCosts.begin(),worker.legCosts.end(),worker.candidateLegCosts.begin());
+
+  ruinWindow(firstDay,lastDay,numRemoved,worker.random(2)==0,flightCosts,&worker);
+  if(!recreateWindow(firstDay,lastDay,worker.random(2)==0,flightCosts,&worker)) { return COST_MAX; }
+
+  int candidateCost = worker.cost;
+  for(int day=firstDay-1;day<=lastDay;day++) { candidateCost += worker.candidateLegCosts[day]-worker.legCosts[day]; }
+  candidateCost += descendAroundWindow(firstDay,lastDay,flightCosts,&worker);
+
+  if(candidateCost<=worker.cost || candidateCost<=worker.bestCost*(1.0+maxDeviation))
+  {
+    std::swap(worker.tour,worker.candidateTour);
+    std::swap(worker.legCosts,worker.candidateLegCosts);
+    worker.cost = candidateCost;
+
+    if(worker.cost<worker.bestCost)
+    {
+      std::copy(worker.tour.begin(),worker.tour.end(),worker.bestTour.begin());
+      worker.bestCost = worker.cost;
+    }
+  }
+
+  return candidateCost;
+}
+
+// runs the ruin-and-recreate steps on one worker per core. the allowed deviation of the record-to-record
+// acceptance falls linearly to zero over the time left. between the epochs, the workers that didn't improve on
+// their best tour restart from the overall best one. the best tour is polished by the variable-depth search at
+// the end. keeps globalBestTour up to date.
+void largeNeighborhoodSearch(const Tour& initialTour,const Array3<int>& flightCosts,const double deadline)
+{
+  const int stepsPerEpoch = 256;
+  const double initialDeviation = 0.01;
+
+  if(initialTour.size()<8) { return; }
+
+  const int numWorkers = numSearchThreads();
+
+  std::vector<LnsWorker> workers;
+  for(int i=0;i<numWorkers;i++) { workers.push_back(LnsWorker(initialTour,flightCosts,threadRandom.next())); }
+
+  const double timeLnsStart = elapsedTime(timeStart);
+  const double timeLnsEnd = timeLnsStart+0.95*(deadline-timeLnsStart); // leaves some time for the polishing
+
+  while(1)
+  {
+    checkTimeOut();
+    const double time = elapsedTime(timeStart);
+    if(time>=timeLnsEnd) { break; }
+
+    const double maxDeviation = initialDeviation*(timeLnsEnd-time)/(timeLnsEnd-timeLnsStart);
+
+    std::vector<int> bestCostsBefore(numWorkers);
+    for(int i=0;i<numWorkers;i++) { bestCostsBefore[i] = workers[i].bestCost; }
+
+    parallelFor(numWorkers,[&](const int i)
+    {
+      for(int step=0;step<stepsPerEpoch;step++) { performLnsStep(maxDeviation,flightCosts,&workers[i]); }
+    });
+
+    for(int i=0;i<numWorkers;i++)
+    {
+      updateGlobalBest(workers[i].bestTour,workers[i].bestCost);
+    }
+
+    const Tour bestTour = getGlobalBestTour();
+    const int bestCost = evalTourCost(bestTour,flightCosts);
+    for(int i=0;i<numWorkers;i++)
+    {
+      if(workers[i].bestCost<bestCostsBefore[i] || workers[i].bestCost==bestCost) { continue; }
+      workers[i] = LnsWorker(bestTour,flightCosts,workers[i].random.next());
+    }
+  }
+
+  const Tour bestTour = performVariableDepthSearch(getGlobalBestTour(),flightCosts);
+  const int bestCost = evalTourCost(bestTour,flightCosts);
+
+  updateGlobalBest(bestTour,bestCost);
+}
+
+// crossover that keeps the (day,city) assignments shared by both parents and fills in the other days in the
+// order of the days. a day gets the city one of the parents visits on it when that's still possible, otherwise
+// the cheapest flight from the previous day's city to a city that hasn't been visited yet. when the next day is
+// already fixed, the city also needs a flight there. returns an empty tour when some day can't be filled.
+Tour crossoverSharedAssignments(const Tour& parentA,
+                                const Tour& parentB,
+                                const Array3<int>& flightCosts,
+                                const Array2<std::vector<CityCost>>& sortedOutboundFlights)
+{
+  const int numDays = parentA.size()-1;
+
+  Tour child(parentA.size(),-1);
+  std::vector<char> isVisited(numDays,0);
+  for(int day=0;day<=numDays;day++)
+  {
+    if(parentA[day]==parentB[day]) { child[day] = parentA[day]; isVisited[child[day]] = 1; }
+  }
+
+  for(int day=1;day<numDays;day++)
+  {
+    if(child[day]>=0) { continue; }
+
+    const int prevCity = child[day-1];
+    const int nextCity = child[day+1]; // -1 when it's not fixed yet
+
+    const int parentCity = (threadRandom(2)==0) ? parentA[day] : parentB[day];
+    if(!isVisited[parentCity] && flightCosts(day-1,prevCity,parentCity)>0 && (nextCity<0 || flightCosts(day,parentCity,nextCity)>0))
+    {
+      child[day] = parentCity;
+    }
+    else
+    {
+      const std::vector<CityCost>& outFlights = sortedOutboundFlights(prevCity,day-1);
+      for(int i=0;i<outFlights.size();i++)
+      {
+        const int city = outFlights[i].city;
+        if(!isVisited[city] && (nextCity<0 || flightCosts(day,city,nextCity)>0)) { child[day] = city; break; }
+      }
+    }
+
+    if(child[day]<0) { return Tour(); }
+    isVisited[child[day]] = 1;
+  }
+
+  if(evalTourCost(child,flightCosts)<0) { return Tour(); }
+
+  return child;
+}
+
+// steady-state genetic algorithm. the population starts from the initial tour and kicked copies of it. every
+// generation breeds a batch of offspring from parents picked by binary tournaments, and each offspring gets a
+// descent by perform2OptWithDLBs, the descents of the batch run in parallel. an offspring then replaces the worst
+// member of the population when it's better and it's not in the population already. when the crossover fails
+// for the whole batch, kicked copies of random members are used instead. keeps globalBestTour up to date.
+void geneticAlgorithm(const Tour& initialTour,
+                      const Array3<int>& flightCosts,
+                      const Array2<std::vector<CityCost>>& sortedOutboundFlights,
+                      const double deadline)
+{
+  const int populationSize = 24;
+  const int batchSize = std::max(8,2*numSearchThreads());
+
+  struct Population
+  {
+    struct Member
+    {
+      Tour tour;
+      int cost;
+      unsigned long long hash;
+    };
+
+    int capacity;
+    std::vector<Member> members;
+
+    void add(const Tour& tour,const int cost)
+    {
+      Member member;
+      member.tour = tour;
+      member.cost = cost;
+      member.hash = zobristHash(tour);
+
+      for(int i=0;i<members.size();i++) { if(members[i].hash==member.hash) { return; } }
+
+      if(members.size()<capacity) { members.push_back(member); return; }
+
+      int worst = 0;
+      for(int i=1;i<members.size();i++) { if(members[i].cost>members[worst].cost) { worst = i; } }
+      if(cost<members[worst].cost) { members[worst] = member; }
+    }
+
+    const Tour& tournament() const
+    {
+      const Member& a = members[threadRandom(members.size())];
+      const Member& b = members[threadRandom(members.size())];
+      return (a.cost<=b.cost) ? a.tour : b.tour;
+    }
+  };
+
+  Population population;
+  population.capacity = populationSize;
+
+  std::vector<Tour> batch;
+  std::vector<int> batchCosts;
+
+  batch.push_back(initialTour);
+  for(int i=1;i<populationSize;i++)
+  {
+    const Tour kickTour = restrictedDoubleBridgeKick(initialTour,flightCosts,1.35,2000);
+    if(!kickTour.empty()) { batch.push_back(kickTour); }
+  }
+
+  while(1)
+  {
+    checkTimeOut();
+
+    batchCosts.resize(batch.size());
+    parallelFor(batch.size(),[&](const int i)
+    {
+      batch[i] = perform2OptWithDLBs(batch[i],flightCosts);
+      batchCosts[i] = evalTourCost(batch[i],flightCosts);
+    });
+
+    for(int i=0;i<batch.size();i++)
+    {
+      population.add(batch[i],batchCosts[i]);
+
+      updateGlobalBest(batch[i],batchCosts[i]);
+    }
+
+    if(elapsedTime(timeStart)>=deadline) { break; }
+
+    batch.clear();
+    for(int attempt=0;attempt<4*batchSize && batch.size()<batchSize;attempt++)
+    {
+      const Tour& parentA = population.tournament();
+      const Tour& parentB = population.tournament();
+      if(&parentA==&parentB) { continue; }
+
+      const Tour child = crossoverSharedAssignments(parentA,parentB,flightCosts,sortedOutboundFlights);
+      if(!child.empty()) { batch.push_back(child); }
+    }
 
-          if(flightCosts(day1-1,bestTour[day1-1],city2) > 0 &&
-             flightCosts(day1  ,city2,bestTour[day1+1]) > 0 &&
-             flightCosts(day2-1,bestTour[day2-1],city1) > 0 &&
-             flightCosts(day2  ,city1,bestTour[day2+1]) > 0)
-          {
-            const int cost = bestCost-(costFromTo1+
-                                       flightCosts(day2-1,bestTour[day2-1],city2)+
-                                       flightCosts(day2  ,city2,bestTour[day2+1]))
-                                     +(flightCosts(day1-1,bestTour[day1-1],city2)+
-                                       flightCosts(day1  ,city2,bestTour[day1+1])+
-                                       flightCosts(day2-1,bestTour[day2-1],city1)+
-                                       flightCosts(day2  ,city1,bestTour[day2+1]));
-
-            if(cost<bestCost)
-            {
-              std::swap(bestTour[day1],bestTour[day2]);
-              bestCost = cost;
-              goto from_scratch;
-            }
-          }
-        }
+    for(int attempt=0;attempt<batchSize && batch.empty();attempt++)
+    {
+      const Tour kickTour = restrictedDoubleBridgeKick(population.members[threadRandom(population.members.size())].tour,flightCosts,1.35,2000);
+      if(!kickTour.empty()) { batch.push_back(kickTour); }
+    }
+  }
+}
 
-        // flip
-        {
-          for(int i=0;i<day2-day1+1;i++)
-          {
-            tour[day1+i] = bestTour[day2-i];
-          }
+// the window of days [firstDay,lastDay] of the tour as a small instance of its own: local city 0 stands for the
+// fixed cities around the window, tour[firstDay-1] when it's flown from and tour[lastDay+1] when it's flown to,
+// and the other local cities are the cities of the window. local day j is day firstDay-1+j of the tour, so a
+// tour of the small instance is a reordering of the window between its two fixed ends.
+Array3<int> makeWindowFlightCosts(const Tour& tour,const int firstDay,const int lastDay,const Array3<int>& flightCosts)
+{
+  const int n = lastDay-firstDay+2;
 
-          const int cost = evalTourCost(tour,flightCosts);
+  Array3<int> windowCosts(n,n,n);
+  for(int day=0;day<n;day++)
+  for(int from=0;from<n;from++)
+  for(int to=0;to<n;to++)
+  {
+    const int fromCity = (from==0) ? tour[firstDay-1] : tour[firstDay-1+from];
+    const int toCity   = (to==0)   ? tour[lastDay+1]  : tour[firstDay-1+to];
+    windowCosts(day,from,to) = (from==to) ? -1 : flightCosts(firstDay-1+day,fromCity,toCity);
+  }
+  return windowCosts;
+}
 
-          if(cost>0 && cost<bestCost)
-          {
-            bestTour = tour;
-            bestCost = cost;
-            goto from_scratch;
-          }
-        }
-      }
+// improves the days [firstDay,lastDay] of the tour and leaves the rest of it alone: the window's tour is
+// optimized by the variable-depth search and then by ruin-and-recreate steps. returns the change of the tour cost.
+int optimizeWindow(const int firstDay,const int lastDay,const int numLnsSteps,const unsigned int seed,const Array3<int>& flightCosts,Tour* inout_tour)
+{
+  Tour& tour = *inout_tour;
+  const int n = lastDay-firstDay+2;
+
+  const Array3<int> windowCosts = makeWindowFlightCosts(tour,firstDay,lastDay,flightCosts);
+
+  Tour windowTour(n+1,0);
+  for(int i=1;i<n;i++) { windowTour[i] = i; }
+
+  const int initialCost = evalTourCost(windowTour,windowCosts);
+  if(initialCost<0) { return 0; }
+
+  Tour bestTour = performVariableDepthSearch(windowTour,windowCosts);
+  int bestCost = evalTourCost(bestTour,windowCosts);
+
+  if(n>=8)
+  {
+    LnsWorker worker(bestTour,windowCosts,seed);
+    for(int step=0;step<numLnsSteps;step++) { performLnsStep(0.0,windowCosts,&worker); }
+    bestTour = worker.bestTour;
+    bestCost = worker.bestCost;
+  }
+
+  const Tour windowCities(tour.begin()+firstDay-1,tour.begin()+lastDay+1);
+  for(int i=1;i<n;i++) { tour[firstDay-1+i] = windowCities[bestTour[i]]; }
+
+  return bestCost-initialCost;
+}
+
+// rolling-horizon decomposition for large instances. the days are cut into windows of windowLength days, and
+// each window is optimized as a small instance of its own with the cities around it fixed, so the cities of a
+// window stay within it. the last day of each window stays fixed, so the windows don't touch each other's days
+// and they're optimized in parallel. the cut moves by half a window from one round to the next, so that the
+// cities can move across the cuts of the previous round. the ruin-and-recreate steps are random, so the rounds
+// go on until 3/4 of the time is used up. the stitched tour is then polished by the variable-depth search over all
+// of its days. keeps globalBestTour up to date.
+void rollingHorizonSearch(const Tour& initialTour,const Array3<int>& flightCosts,const double deadline)
+{
+  const int windowLength = 48;
+  const int numLnsSteps = 256;
+
+  Tour tour = initialTour;
+  int cost = evalTourCost(tour,flightCosts);
+  const int lastDay = tour.size()-2;
+
+  const double timeRollingEnd = elapsedTime(timeStart)+0.75*(deadline-elapsedTime(timeStart)); // leaves time for the polishing
+
+  for(int round=0;elapsedTime(timeStart)<timeRollingEnd;round++)
+  {
+    checkTimeOut();
+
+    std::vector<std::pair<int,int>> windows;
+    const int offset = (round%2==0) ? 0 : windowLength/2;
+    for(int firstDay=1-offset;firstDay<=lastDay;firstDay+=windowLength)
+    {
+      windows.push_back(std::make_pair(std::max(1,firstDay),std::min(lastDay,firstDay+windowLength-2)));
     }
 
-    break; // exhausted all improving moves, terminate
+    std::vector<unsigned int> seeds(windows.size()); // drawn here, so the windows don't depend on which worker gets them
+    for(int i=0;i<windows.size();i++) { seeds[i] = threadRandom.next(); }
+
+    std::vector<int> deltas(windows.size(),0);
+    parallelFor(windows.size(),[&](const int i)
+    {
+      if(windows[i].second-windows[i].first<2) { return; }
+      deltas[i] = optimizeWindow(windows[i].first,windows[i].second,numLnsSteps,seeds[i],flightCosts,&tour);
+    });
+
+    int delta = 0;
+    for(int i=0;i<deltas.size();i++) { delta += deltas[i]; }
+    cost += delta;
+
+    updateGlobalBest(tour,cost);
   }
 
-  return bestTour; // the tour is now 2-opt
+  tour = performVariableDepthSearch(tour,flightCosts);
+  updateGlobalBest(tour,evalTourCost(tour,flightCosts));
 }
 
-void updateDontLookBits(const Tour& oldTour,const Tour& newTour,std::vector<int>* inout_dontLookBits)
+// portfolio of strategies sharing the best tour. first, the other constructors (double-ended NN, beam search and
+// regret insertion) build their tours on separate threads, next to the initial look-ahead NN tour, and each tour
+// is descended by 2-opt before it's offered to the shared best. then every thread keeps running one of the
+// improvement engines from the shared best for a time slice. a thread picks the engine that improved the shared
+// best most recently, or a random one every fourth time, so the threads drift towards the engine that works on
+// the instance while the others still get tried.
+void portfolioSearch(const Tour& initialTour,
+                     const Array3<int>& flightCosts,
+                     const Array2<std::vector<CityCost>>& sortedOutboundFlights,
+                     const Array2<std::vector<CityCost>>& sortedInboundFlights,
+                     const double deadline)
 {
-  std::vector<int>& dontLookBits = *inout_dontLookBits;
-  const int numCities = oldTour.size()-1;
-  const int resetDepth = 3;
-  for(int city=0;city<numCities;city++)
+  struct Strategy
+  {
+    const char* name;
+    void (*run)(const Tour&,const Array3<int>&,const double);
+    double timeOfLastImprovement;
+    int numRuns;
+  };
+
+  std::vector<Strategy> strategies;
+  strategies.push_back(Strategy{"ils",iteratedLocalSearch,0,0});
+  strategies.push_back(Strategy{"anneal",simulatedAnnealing,0,0});
+  strategies.push_back(Strategy{"lns",largeNeighborhoodSearch,0,0});
+
+  parallelFor(3,[&](const int i)
   {
-    int oldTourSlot = -1;
-    int newTourSlot = -1;
-    for(int slot=0;slot<oldTour.size();slot++) { if(oldTour[slot]==city) { oldTourSlot = slot; break; }}
-    for(int slot=0;slot<newTour.size();slot++) { if(newTour[slot]==city) { newTourSlot = slot; break; }}
+    Tour tour;
+    if(i==0) { tour = makeBestDoubleEndedNNTour(startCity,numCities,flightCosts,sortedOutboundFlights,sortedInboundFlights,1000); }
+    if(i==1) { tour = makeBeamSearchTour(startCity,numCities,flightCosts); }
+    if(i==2) { tour = makeRegretInsertionTour(startCity,numCities,flightCosts); }
+    if(tour.empty()) { return; }
 
-    if((oldTourSlot>0                && newTourSlot>0                && oldTour[oldTourSlot-1]!=newTour[newTourSlot-1]) ||
-       (oldTourSlot<oldTour.size()-1 && newTourSlot<newTour.size()-1 && oldTour[oldTourSlot+1]!=newTour[newTourSlot+1]))
+    tour = perform2OptWithDLBs(tour,flightCosts);
+    updateGlobalBest(tour,evalTourCost(tour,flightCosts));
+  });
+
+  updateGlobalBest(initialTour,evalTourCost(initialTour,flightCosts));
+
+  std::mutex strategiesMutex;
+  const double timeSlice = std::max(0.5,(deadline-elapsedTime(timeStart))/20.0);
+
+  const int numThreads = numSearchThreads();
+  const int maxSearchThreadsOfCaller = maxSearchThreads;
+
+  parallelFor(numThreads,[&](const int)
+  {
+    maxSearchThreads = 1;
+
+    while(elapsedTime(timeStart)<deadline)
     {
-      for(int offset=-resetDepth;offset<=+resetDepth;offset++)
+      int picked = -1;
       {
-        const int target = oldTourSlot+offset;
-        if(target>=0 && target<newTour.size())
+        std::lock_guard<std::mutex> lock(strategiesMutex);
+        for(int i=0;i<strategies.size() && picked<0;i++) { if(strategies[i].numRuns==0) { picked = i; } } // untried ones go first
+        if(picked<0 && threadRandom(4)==0) { picked = threadRandom(strategies.size()); }
+        if(picked<0)
         {
-          dontLookBits[oldTour[target]] = 0;
+          picked = 0;
+          for(int i=1;i<strategies.size();i++) { if(strategies[i].timeOfLastImprovement>strategies[picked].timeOfLastImprovement) { picked = i; } }
         }
+        strategies[picked].numRuns++;
+      }
+
+      const int improvementsBefore = improvementsOfThisThread;
+      strategies[picked].run(getGlobalBestTour(),flightCosts,std::min(deadline,elapsedTime(timeStart)+timeSlice));
+
+      if(improvementsOfThisThread>improvementsBefore)
+      {
+        std::lock_guard<std::mutex> lock(strategiesMutex);
+        strategies[picked].timeOfLastImprovement = elapsedTime(timeStart);
       }
     }
-  }
+  });
+
+  maxSearchThreads = maxSearchThreadsOfCaller; // the threads may have run inline on the calling one
 }
 
-Tour perform2OptWithDLBs(const Tour& initialTour,const Array3<int>& flightCosts)
+// times the swap kernels against each other on the given tour and checks that they agree
+void benchmarkSwapKernels(const Tour& tour,const Array3<int>& flightCosts)
 {
-  Tour bestTour = initialTour;
-  int bestCost = evalTourCost(bestTour,flightCosts);
+  std::vector<int> legCosts(tour.size()-1);
+  for(int day=0;day<tour.size()-1;day++) { legCosts[day] = flightCosts(day,tour[day],tour[day+1]); }
 
-  const int numCities = flightCosts.width();
-  std::vector<int> dontLookBits = std::vector<int>(numCities,0);
+  struct Kernel { const char* name; FindBestSwapKernel kernel; };
+  std::vector<Kernel> kernels;
+  kernels.push_back(Kernel{"scalar",findBestSwapScalar});
+#ifdef SIMD_KERNELS
+  if(gatherIndicesFit(flightCosts) && cpuSupportsAVX2())   { kernels.push_back(Kernel{"avx2",findBestSwapAVX2}); }
+  if(gatherIndicesFit(flightCosts) && cpuSupportsAVX512()) { kernels.push_back(Kernel{"avx512",findBestSwapAVX512}); }
+#endif
 
-  while(1)
+  const int numRounds = std::max(1,20000000/int(tour.size()*tour.size()));
+
+  std::vector<int> referenceMoves;
+  for(int k=0;k<kernels.size();k++)
   {
-  from_scratch:
-    checkTimeOut();
+    std::vector<int> moves;
+    int checksum = 0;
 
-    for(int day1=1;day1<bestTour.size()-2;day1++)
+    std::chrono::steady_clock::time_point timeKernelStart = std::chrono::steady_clock::now();
+    for(int round=0;round<numRounds;round++)
+    for(int day1=1;day1<tour.size()-2;day1++)
     {
-      if(dontLookBits[bestTour[day1-1]]==1) { continue; }
+      int delta = 0;
+      const int day2 = kernels[k].kernel(tour,legCosts,day1,day1+2,tour.size()-1,flightCosts,&delta);
+      checksum += day2+delta;
+      if(round==0) { moves.push_back(day2); moves.push_back(delta); }
+    }
+    const double seconds = elapsedTime(timeKernelStart);
 
-      Tour tour = bestTour;
+    if(k==0) { referenceMoves = moves; }
 
-      const int city1 = bestTour[day1];
-      const int costFromTo1 = flightCosts(day1-1,bestTour[day1-1],city1)+
-                              flightCosts(day1  ,city1,bestTour[day1+1]);
+    const double numCandidates = double(numRounds)*double(tour.size()-3)*double(tour.size()-4)/2.0;
+    fprintf(stderr,"%-8s %8.3f s %10.1f M candidates/s %s (checksum %d)\n",kernels[k].name,seconds,numCandidates/(seconds*1e6),
+            (moves==referenceMoves) ? "ok" : "MISMATCH",checksum);
+  }
+}
 
-      for(int day2=day1+1;day2<bestTour.size()-1;day2++)
-      {
-        // swap
-        if(day2==day1+1)
-        {
-          Tour tour = bestTour;
-          std::swap(tour[day1],tour[day2]);
-          int cost = evalTourCost(tour,flightCosts);
-          if(cost>0 && cost<bestCost)
-          {
-            updateDontLookBits(bestTour,tour,&dontLookBits);
-            bestTour = tour;
-            bestCost = cost;
-            goto from_scratch;
-          }
-        }
-        else
-        {
-          const int city2 = bestTour[day2];
+// times the batched tour evaluation against evalTourCost on copies of the given tour with two random cities swapped
+void benchmarkTourCostKernels(const Tour& tour,const Array3<int>& flightCosts)
+{
+  TourBatch batch(256,tour.size());
+  std::vector<Tour> tours;
+  while(batch.numTours<batch.capacity)
+  {
+    Tour swapTour = tour;
+    std::swap(swapTour[1+threadRandom(tour.size()-2)],swapTour[1+threadRandom(tour.size()-2)]);
+    tours.push_back(swapTour);
+    addTourToBatch(swapTour,&batch);
+  }
 
-          if(flightCosts(day1-1,bestTour[day1-1],city2) > 0 &&
-             flightCosts(day1  ,city2,bestTour[day1+1]) > 0 &&
-             flightCosts(day2-1,bestTour[day2-1],city1) > 0 &&
-             flightCosts(day2  ,city1,bestTour[day2+1]) > 0)
-          {
-            const int cost = bestCost-(costFromTo1+
-                                       flightCosts(day2-1,bestTour[day2-1],city2)+
-                                       flightCosts(day2  ,city2,bestTour[day2+1]))
-                                     +(flightCosts(day1-1,bestTour[day1-1],city2)+
-                                       flightCosts(day1  ,city2,bestTour[day1+1])+
-                                       flightCosts(day2-1,bestTour[day2-1],city1)+
-                                       flightCosts(day2  ,city1,bestTour[day2+1]));
-
-            if(cost<bestCost)
-            {
-              Tour tour = bestTour;
-              std::swap(tour[day1],tour[day2]);
-              updateDontLookBits(bestTour,tour,&dontLookBits);
-              bestTour = tour;
-              bestCost = cost;
-              goto from_scratch;
-            }
-          }
-        }
+  const int numRounds = std::max(1,20000000/int(batch.numTours*tour.size()));
+  std::vector<int> costs(batch.capacity);
 
-        // flip
-        {
-          for(int i=0;i<day2-day1+1;i++)
-          {
-            tour[day1+i] = bestTour[day2-i];
-          }
+  std::vector<int> referenceCosts(batch.numTours);
+  for(int i=0;i<batch.numTours;i++) { referenceCosts[i] = evalTourCost(tours[i],flightCosts); }
 
-          const int cost = evalTourCost(tour,flightCosts);
+  {
+    int checksum = 0;
+    std::chrono::steady_clock::time_point timeKernelStart = std::chrono::steady_clock::now();
+    for(int round=0;round<numRounds;round++)
+    for(int i=0;i<batch.numTours;i++) { checksum += evalTourCost(tours[i],flightCosts); }
+    const double seconds = elapsedTime(timeKernelStart);
+    fprintf(stderr,"%-8s %8.3f s %10.2f M tours/s ok (checksum %d)\n","tour",seconds,double(numRounds)*batch.numTours/(seconds*1e6),checksum);
+  }
 
-          if(cost>0 && cost<bestCost)
-          {
-            updateDontLookBits(bestTour,tour,&dontLookBits);
-            bestTour = tour;
-            bestCost = cost;
-            goto from_scratch;
-          }
-        }
-      }
+  struct Kernel { const char* name; EvalTourCostsKernel kernel; };
+  std::vector<Kernel> kernels;
+  kernels.push_back(Kernel{"scalar",evalTourCostsScalar});
+#ifdef SIMD_KERNELS
+  if(gatherIndicesFit(flightCosts) && cpuSupportsAVX2())   { kernels.push_back(Kernel{"avx2",evalTourCostsAVX2}); }
+  if(gatherIndicesFit(flightCosts) && cpuSupportsAVX512()) { kernels.push_back(Kernel{"avx512",evalTourCostsAVX512}); }
+#endif
 
-      dontLookBits[bestTour[day1-1]] = 1;
+  for(int k=0;k<kernels.size();k++)
+  {
+    int checksum = 0;
+    std::chrono::steady_clock::time_point timeKernelStart = std::chrono::steady_clock::now();
+    for(int round=0;round<numRounds;round++)
+    {
+      kernels[k].kernel(batch,flightCosts,costs.data());
+      for(int i=0;i<batch.numTours;i++) { checksum += costs[i]; }
     }
+    const double seconds = elapsedTime(timeKernelStart);
 
-    break; // exhausted all improving moves, terminate
+    const bool agrees = std::equal(referenceCosts.begin(),referenceCosts.end(),costs.begin());
+    fprintf(stderr,"%-8s %8.3f s %10.2f M tours/s %s (checksum %d)\n",kernels[k].name,seconds,double(numRounds)*batch.numTours/(seconds*1e6),
+            agrees ? "ok" : "MISMATCH",checksum);
   }
+}
+
+// runs each of the search engines from the same tour for the given number of seconds and reports the best
+// tour cost reached by each of them. the engines that need the sorted flights are skipped when there are none,
+// which is the case on the instances that are too large for them
+void benchmarkSearchEngines(const Tour& tour,
+                            const Array3<int>& flightCosts,
+                            const Array2<std::vector<CityCost>>& sortedOutboundFlights,
+                            const Array2<std::vector<CityCost>>& sortedInboundFlights,
+                            const double seconds)
+{
+  typedef std::function<void(const Tour&,const Array3<int>&,const double)> EngineFunc;
+  struct Engine { const char* name; EngineFunc run; bool needsSortedFlights; };
+  std::vector<Engine> engines;
+  engines.push_back(Engine{"ils",iteratedLocalSearch,false});
+  engines.push_back(Engine{"anneal",simulatedAnnealing,false});
+  engines.push_back(Engine{"tempering",parallelTempering,false});
+  engines.push_back(Engine{"genetic",[&](const Tour& tour,const Array3<int>& flightCosts,const double deadline)
+  {
+    geneticAlgorithm(tour,flightCosts,sortedOutboundFlights,deadline);
+  },true});
+  engines.push_back(Engine{"guided",guidedLocalSearch,false});
+  engines.push_back(Engine{"tabu",tabuSearch,false});
+  engines.push_back(Engine{"lns",largeNeighborhoodSearch,false});
+  engines.push_back(Engine{"portfolio",[&](const Tour& tour,const Array3<int>& flightCosts,const double deadline)
+  {
+    portfolioSearch(tour,flightCosts,sortedOutboundFlights,sortedInboundFlights,deadline);
+  },true});
+  engines.push_back(Engine{"rolling",rollingHorizonSearch,false});
+
+  for(int e=0;e<engines.size();e++)
+  {
+    if(engines[e].needsSortedFlights && (sortedOutboundFlights.numel()==0 || sortedInboundFlights.numel()==0))
+    {
+      fprintf(stderr,"%-10s skipped, the flights aren't sorted on this instance\n",engines[e].name);
+      continue;
+    }
 
-  return bestTour; // the tour is now 2-opt
+    {
+      std::lock_guard<std::mutex> lock(globalBestMutex); // updateGlobalBest would keep the better tour of the previous engine
+      globalBestTour = tour;
+      globalBestCost = evalTourCost(tour,flightCosts);
+    }
+
+    const double timeEngineStart = elapsedTime(timeStart);
+    engines[e].run(tour,flightCosts,timeEngineStart+seconds);
+
+    fprintf(stderr,"%-10s %8.3f s cost %d -> %d\n",engines[e].name,elapsedTime(timeStart)-timeEngineStart,evalTourCost(tour,flightCosts),evalTourCost(getGlobalBestTour(),flightCosts));
+  }
 }
 
 int parseInt(char** input)
@@ -742,129 +4455,383 @@ bool readInputFast(FILE* file,int* out_numCities,int* out_startCity,Array3<int>*
 
   if(out_numCities!=0)  { *out_numCities  = numCities; }
   if(out_startCity!=0)  { *out_startCity  = startCity; }
-  if(out_flightCost!=0) { *out_flightCost = flightCosts; }
+  if(out_flightCost!=0) { out_flightCost->swap(flightCosts); } // a copy would double the peak memory
   if(out_cityNames!=0)  { *out_cityNames  = cities.names; }
 
   return true;
 }
 
-void solveBruteForce()
+// reads a tour in the format printTour writes. the cities that aren't in the instance are skipped, and the
+// cities of the instance that aren't in the tour are appended before the return to the start city, so the result
+// visits every city once but may have legs without a flight. returns false when the file has no legs.
+bool readTour(FILE* file,const int startCity,const std::vector<std::string>& cityNames,Tour* out_tour)
 {
-  Tour tour;
-  tour.push_back(startCity);
-  for(int i=0;i<numCities;i++) { if(i!=startCity) { tour.push_back(i); } }
-  tour.push_back(startCity);
+  std::unordered_map<std::string,int> nameToCity;
+  for(int i=0;i<cityNames.size();i++) { nameToCity[cityNames[i]] = i; }
 
-  globalBestCost = COST_MAX;
+  char line[4096];
+  if(fgets(line,4095,file)==NULL) { return false; } // the cost
 
-  while(1)
+  std::vector<int> visitedCities;
+  while(fgets(line,4095,file)!=NULL)
   {
-    const int cost = evalTourCost(tour,flightCosts);
-
-    if(cost>0 && cost<globalBestCost)
-    {
-      globalBestTour = tour;
-      globalBestCost = cost;
-    }
+    if(strlen(line)<7) { continue; }
+    const std::string toName(&line[4],3);
+    const auto it = nameToCity.find(toName);
+    if(it!=nameToCity.end()) { visitedCities.push_back(it->second); }
+  }
+  if(visitedCities.empty()) { return false; }
 
-    if(!std::next_permutation(tour.begin()+1,tour.end()-1)) { break; }
+  std::vector<unsigned char> isVisited(cityNames.size(),0);
+  Tour tour;
+  tour.push_back(startCity);
+  isVisited[startCity] = 1;
+  for(int i=0;i<visitedCities.size();i++)
+  {
+    if(!isVisited[visitedCities[i]]) { tour.push_back(visitedCities[i]); isVisited[visitedCities[i]] = 1; }
   }
+  for(int city=0;city<cityNames.size();city++) { if(!isVisited[city]) { tour.push_back(city); } }
+  tour.push_back(startCity);
 
-  if(!globalBestTour.empty()) { printTour(stdout,globalBestTour,flightCosts,cityNames); }
+  *out_tour = tour;
+  return true;
+}
 
-  exit(0);
+int countMissingLegs(const Tour& tour,const Array3<int>& flightCosts)
+{
+  int count = 0;
+  for(int day=0;day<tour.size()-1;day++) { if(flightCosts(day,tour[day],tour[day+1])<0) { count++; } }
+  return count;
 }
 
-int main(int argc,char** argv)
+// makes a tour with legs that have no flight valid again by a descent over swaps and relocations, where a missing
+// leg costs lnsMissingLegCost. only the cities next to a missing leg get moved, to any other day. when no single
+// move helps, a move followed by a swap of a city next to a leg the move broke is tried, starting from the few
+// first moves that break the fewest legs. the rest of the tour keeps its order, so a tour that's valid stays
+// untouched. returns an empty tour when the repair gets stuck, or when it takes a few times as many steps as
+// there were cities next to a missing leg.
+Tour repairTour(const Tour& initialTour,const Array3<int>& flightCosts)
 {
-  timeStart = std::chrono::steady_clock::now();
+  struct Move
+  {
+    AnnealingMove type;
+    int day1,day2;
+    int delta;
+  };
 
-  readInputFast(stdin,&numCities,&startCity,&flightCosts,&cityNames);
+  const int maxPairStarts = 16; // the first moves of a pair that get followed by the search for the second one
 
-  if(numCities<=10) { solveBruteForce(); }
+  Tour tour = initialTour;
+  const int lastTourDay = tour.size()-2;
 
-  const Array2<std::vector<CityCost>> sortedOutboundFlights = sortOutboundFlights(flightCosts,numCities);
+  const auto evalLegsCost = [&](const int firstDay,const int lastDay) // the legs that start on the days
+  {
+    int cost = 0;
+    for(int day=firstDay;day<=lastDay;day++) { cost += evalLnsLegCost(day,tour[day],tour[day+1],flightCosts); }
+    return cost;
+  };
 
-  Tour initTour = makeNNTourWithLookAhead(startCity,numCities,flightCosts,sortedOutboundFlights);
+  // a swap only changes the legs next to the two days, a relocation shifts the cities in between by one day
+  const auto applyMove = [&](const AnnealingMove type,const int day1,const int day2)
+  {
+    if(type==ANNEALING_SWAP) { std::swap(tour[day1],tour[day2]); }
+    else if(day2>day1)       { std::rotate(tour.begin()+day1,tour.begin()+day1+1,tour.begin()+day2+1); }
+    else                     { std::rotate(tour.begin()+day2,tour.begin()+day1,tour.begin()+day1+1); }
+  };
+  const auto undoMove = [&](const AnnealingMove type,const int day1,const int day2)
+  {
+    if(type==ANNEALING_SWAP) { applyMove(type,day1,day2); } else { applyMove(type,day2,day1); }
+  };
+  const auto evalMoveDelta = [&](const AnnealingMove type,const int day1,const int day2)
+  {
+    const int lo = std::min(day1,day2);
+    const int hi = std::max(day1,day2);
+    const bool isFarSwap = (type==ANNEALING_SWAP && hi>lo+1);
+    const int oldCost = isFarSwap ? evalLegsCost(lo-1,lo)+evalLegsCost(hi-1,hi) : evalLegsCost(lo-1,hi);
+    applyMove(type,day1,day2);
+    const int newCost = isFarSwap ? evalLegsCost(lo-1,lo)+evalLegsCost(hi-1,hi) : evalLegsCost(lo-1,hi);
+    undoMove(type,day1,day2);
+    return newCost-oldCost;
+  };
 
-  if(initTour.empty())
+  const auto findBrokenDays = [&]()
   {
-    const Array2<std::vector<CityCost>> sortedInboundFlights = sortInboundFlights(flightCosts,numCities);
+    std::vector<int> brokenDays;
+    for(int day=0;day<=lastTourDay;day++)
+    {
+      if(flightCosts(day,tour[day],tour[day+1])<0)
+      {
+        if(day>0)           { brokenDays.push_back(day); }
+        if(day<lastTourDay) { brokenDays.push_back(day+1); }
+      }
+    }
+    return brokenDays;
+  };
+  const int maxSteps = 2*findBrokenDays().size()+16;
 
-    Tour bestDENNTour;
-    int bestDENNCost = COST_MAX;
-    for(int iter=0;iter<1000;iter++)
+  // the best of the moves of the broken days with any other day, delta is 0 when none of them improves
+  const auto findBestMove = [&](const std::vector<int>& brokenDays,const int numTypes)
+  {
+    const AnnealingMove types[2] = { ANNEALING_SWAP,ANNEALING_RELOCATE };
+    Move best = { ANNEALING_SWAP,-1,-1,0 };
+    for(int i=0;i<brokenDays.size();i++)
     {
-      const int fromCity = 1+(rand()%(numCities-1));
-      const int fromDay  = 1+(rand()%(numCities-1));
-      const Tour tour = makeDoubleEndedNNTour(fromCity,fromDay,startCity,numCities,flightCosts,sortedOutboundFlights,sortedInboundFlights);
-      if(!tour.empty())
+      checkTimeOut();
+      for(int day2=1;day2<=lastTourDay;day2++)
       {
-        int cost = evalTourCost(tour,flightCosts);
-        if(cost>0 && cost<bestDENNCost)
+        if(day2==brokenDays[i]) { continue; }
+        for(int t=0;t<numTypes;t++)
         {
-          bestDENNCost = cost;
-          bestDENNTour = tour;
+          const int delta = evalMoveDelta(types[t],brokenDays[i],day2);
+          if(delta<best.delta) { best.type = types[t]; best.day1 = brokenDays[i]; best.day2 = day2; best.delta = delta; }
         }
       }
     }
+    return best;
+  };
 
-    initTour = bestDENNTour;
-  }
+  for(int step=0;step<maxSteps;step++)
+  {
+    const std::vector<int> brokenDays = findBrokenDays();
+    if(brokenDays.empty()) { return tour; }
 
-  if(initTour.empty()) { initTour = makeRandomTour(startCity,numCities,flightCosts,10000); }
+    const Move move = findBestMove(brokenDays,2);
+    if(move.day1>=0) { applyMove(move.type,move.day1,move.day2); continue; }
 
-  if(initTour.empty()) { exit(0); }
+    // no single move helps, look for a pair of them, the second one being a swap
+    std::vector<Move> firstMoves;
+    for(int i=0;i<brokenDays.size();i++)
+    {
+      checkTimeOut();
+      for(int day2=1;day2<=lastTourDay;day2++)
+      {
+        if(day2==brokenDays[i]) { continue; }
+        for(int t=0;t<2;t++)
+        {
+          const AnnealingMove type = (t==0) ? ANNEALING_SWAP : ANNEALING_RELOCATE;
+          const int delta = evalMoveDelta(type,brokenDays[i],day2);
+          if(delta<lnsMissingLegCost) { firstMoves.push_back({ type,brokenDays[i],day2,delta }); } // else it breaks more legs than it fixes
+        }
+      }
+    }
+    const int numPairStarts = std::min(int(firstMoves.size()),maxPairStarts);
+    std::partial_sort(firstMoves.begin(),firstMoves.begin()+numPairStarts,firstMoves.end(),
+                      [](const Move& a,const Move& b) { return a.delta<b.delta; });
+
+    bool improved = false;
+    for(int i=0;i<numPairStarts && !improved;i++)
+    {
+      const Move& first = firstMoves[i];
+      applyMove(first.type,first.day1,first.day2);
+      const Move second = findBestMove(findBrokenDays(),1);
+      if(second.day1>=0 && first.delta+second.delta<0)
+      {
+        applyMove(second.type,second.day1,second.day2);
+        improved = true;
+      }
+      else
+      {
+        undoMove(first.type,first.day1,first.day2);
+      }
+    }
+    if(!improved) { return Tour(); }
+  }
 
-  initTour = perform2Opt(initTour,flightCosts);
+  return findBrokenDays().empty() ? tour : Tour();
+}
 
-  const int initCost = evalTourCost(initTour,flightCosts);
+void solveBruteForce()
+{
+  Tour tour;
+  tour.push_back(startCity);
+  for(int i=0;i<numCities;i++) { if(i!=startCity) { tour.push_back(i); } }
+  tour.push_back(startCity);
 
-  globalBestTour = initTour;
-  globalBestCost = initCost;
+  globalBestCost = COST_MAX;
 
-  Tour tour = globalBestTour;
-  int cost = globalBestCost;
+  // the permutations are generated and evaluated in batches
+  TourBatch batch(256,tour.size());
+  std::vector<int> costs(batch.capacity);
 
-  std::chrono::steady_clock::time_point timeOfLastImprovement = std::chrono::steady_clock::now();
-  while(1)
+  bool morePermutations = true;
+  while(morePermutations)
   {
-    checkTimeOut();
+    batch.numTours = 0;
+    while(morePermutations && batch.numTours<batch.capacity)
+    {
+      addTourToBatch(tour,&batch);
+      morePermutations = std::next_permutation(tour.begin()+1,tour.end()-1);
+    }
 
-    if(numCities<100 && elapsedTime(timeOfLastImprovement)>4.0)
+    evalTourCosts(batch,flightCosts,costs.data());
+
+    for(int i=0;i<batch.numTours;i++)
     {
-      const Tour restartTour = restrictedDoubleBridgeKick(globalBestTour,flightCosts,1.15,2000);
-      if(!restartTour.empty())
+      if(costs[i]>0 && costs[i]<globalBestCost)
       {
-        tour = restartTour;
-        cost = evalTourCost(tour,flightCosts);
-        timeOfLastImprovement = std::chrono::steady_clock::now();
+        globalBestTour = getTourFromBatch(batch,i);
+        globalBestCost = costs[i];
       }
     }
+  }
+
+  if(!globalBestTour.empty()) { tourStream.push(globalBestTour,globalBestCost); }
+
+  printBestTourAndExit();
+}
 
-    const double maxAllowedCostIncrease = (numCities<100) ? 1.35 : (numCities>100 ? 1.075 : 1.1);
+int main(int argc,char** argv)
+{
+  timeStart = std::chrono::steady_clock::now();
 
-    Tour kickTour = restrictedDoubleBridgeKick(tour,flightCosts,maxAllowedCostIncrease,2000);
+  readInputFast(stdin,&numCities,&startCity,&flightCosts,&cityNames);
 
-    if(!kickTour.empty())
+  findBestSwap = selectFindBestSwapKernel(flightCosts);
+  evalTourCosts = selectEvalTourCostsKernel(flightCosts);
+
+  bool benchmark = false;
+  bool anneal = false;
+  bool tempering = false;
+  bool genetic = false;
+  bool guided = false;
+  bool tabu = false;
+  bool lns = false;
+  bool portfolio = false;
+  bool rolling = false;
+  const char* warmStartFileName = 0;
+  for(int i=1;i<argc;i++)
+  {
+    if(strcmp(argv[i],"--benchmark")==0) { benchmark = true; }
+    if(strcmp(argv[i],"--anneal")==0)    { anneal = true; }
+    if(strcmp(argv[i],"--tempering")==0) { tempering = true; }
+    if(strcmp(argv[i],"--genetic")==0)   { genetic = true; }
+    if(strcmp(argv[i],"--guided")==0)    { guided = true; }
+    if(strcmp(argv[i],"--tabu")==0)      { tabu = true; }
+    if(strcmp(argv[i],"--lns")==0)       { lns = true; }
+    if(strcmp(argv[i],"--portfolio")==0) { portfolio = true; }
+    if(strcmp(argv[i],"--rolling")==0)   { rolling = true; }
+    if(strcmp(argv[i],"--time")==0 && i+1<argc) { timeOut = atof(argv[++i]); }
+    if(strcmp(argv[i],"--warm-start")==0 && i+1<argc) { warmStartFileName = argv[++i]; }
+    if(strcmp(argv[i],"--stream")==0 && i+1<argc)
     {
-      kickTour = perform2OptWithDLBs(kickTour,flightCosts);
-      const int kickCost = evalTourCost(kickTour,flightCosts);
+      const char* fileName = argv[++i];
+      if(!tourStream.open(fileName)) { fprintf(stderr,"can't open %s for streaming\n",fileName); }
+    }
+  }
 
-      if(kickCost<cost)
-      {
-        tour = kickTour;
-        cost = kickCost;
-        timeOfLastImprovement = std::chrono::steady_clock::now();
-      }
+  if(numCities<=10) { solveBruteForce(); }
+
+  if(!benchmark) { startDeadlineTimer(); } // the benchmark gives each engine its own time, regardless of the budget
+  if(numCities>=1000 && !rolling)
+  {
+    if(anneal || tempering || genetic || guided || tabu || lns || portfolio)
+    {
+      fprintf(stderr,"%d cities, running the rolling horizon in place of the chosen engine\n",numCities);
+    }
+    rolling = true;
+  }
+
+  makeZobristKeys(numCities);
+
+  // the domain pass and the pruning walk all of flightCosts several times, which the rolling horizon can't afford
+  // on the instances it's on by default for. its windows are built without the pruned flights, and the domain is
+  // only made when the backtracking fallback needs it
+  Array2<unsigned char> dayCityDomain;
+  if(!rolling)
+  {
+    dayCityDomain = makeDayCityDomain(startCity,numCities,flightCosts);
+    pruneFlightCosts(dayCityDomain,numCities,&flightCosts);
+  }
+
+  // the sorted flights hold numCities^3 CityCosts, which don't fit in memory on the instances where the rolling
+  // horizon is on by default. its beam search does without them, the fallbacks sort them when they're needed
+  Array2<std::vector<CityCost>> sortedOutboundFlights;
+  Array2<std::vector<CityCost>> sortedInboundFlights;
+  if(!rolling) { sortedOutboundFlights = sortOutboundFlights(flightCosts,numCities); }
+  if(!rolling && (portfolio || benchmark)) { sortedInboundFlights = sortInboundFlights(flightCosts,numCities); }
+
+  // a tour from an earlier run, used in place of the constructed one when it's cheaper. a tour that lost more
+  // than a tenth of its flights is too stale to be worth repairing, the repair would only make a worse start
+  Tour warmStartTour;
+  if(warmStartFileName!=0)
+  {
+    FILE* file = fopen(warmStartFileName,"r");
+    Tour tour;
+    if(file!=0 && readTour(file,startCity,cityNames,&tour) && countMissingLegs(tour,flightCosts)*10<=numCities)
+    {
+      warmStartTour = repairTour(tour,flightCosts);
     }
+    if(file!=0) { fclose(file); }
+    if(warmStartTour.empty()) { fprintf(stderr,"can't warm-start from %s, constructing the tour instead\n",warmStartFileName); }
+  }
+
+  Tour initTour;
+  if(rolling) // the look-ahead NN tour takes too long to build on large instances
+  {
+    initTour = makeBeamSearchTour(startCity,numCities,flightCosts,8,4,true);
+    if(evalTourCost(initTour,flightCosts)<0) { initTour = repairTour(initTour,flightCosts); }
+  }
+  else
+  {
+    initTour = makeNNTourWithLookAhead(startCity,numCities,flightCosts,sortedOutboundFlights);
 
-    if(cost<globalBestCost)
+    // the insertion tour is only a fallback for when the look-ahead runs into a dead end, it's slower
+    // to build and the portfolio already tries it alongside the other constructors
+    if(initTour.empty()) { initTour = makeRegretInsertionTour(startCity,numCities,flightCosts); }
+  }
+
+  const int warmStartCost = warmStartTour.empty() ? -1 : evalTourCost(warmStartTour,flightCosts);
+  if(warmStartCost>=0 && (initTour.empty() || warmStartCost<evalTourCost(initTour,flightCosts))) { initTour = warmStartTour; }
+
+  if(initTour.empty())
+  {
+    if(sortedOutboundFlights.numel()==0) { sortedOutboundFlights = sortOutboundFlights(flightCosts,numCities); }
+    if(sortedInboundFlights.numel()==0)  { sortedInboundFlights = sortInboundFlights(flightCosts,numCities); }
+
+    initTour = makeBestDoubleEndedNNTour(startCity,numCities,flightCosts,sortedOutboundFlights,sortedInboundFlights,1000);
+
+    if(initTour.empty()) // sparse instance, search for any feasible tour
     {
-      globalBestTour = tour;
-      globalBestCost = cost;
+      if(dayCityDomain.numel()==0) { dayCityDomain = makeDayCityDomain(startCity,numCities,flightCosts); }
+      initTour = makeTourWithBacktracking(startCity,numCities,flightCosts,dayCityDomain);
     }
   }
 
+  if(initTour.empty()) { initTour = makeRandomTour(startCity,numCities,flightCosts,10000); }
+
+  if(initTour.empty()) { exit(0); }
+
+  // from here on there's a tour to print when the search gets stopped
+  globalBestCost = COST_MAX;
+  updateGlobalBest(initTour,evalTourCost(initTour,flightCosts));
+
+  if(benchmark)
+  {
+    benchmarkSwapKernels(initTour,flightCosts);
+    benchmarkTourCostKernels(initTour,flightCosts);
+    benchmarkSearchEngines(perform2Opt(perform2OptParallel(initTour,flightCosts),flightCosts),flightCosts,sortedOutboundFlights,sortedInboundFlights,3.0);
+    exit(0);
+  }
+
+  if(!rolling) // the windows of the rolling horizon are optimized anyway
+  {
+    // the parallel scans do most of the descent on all cores, perform2Opt only confirms the local optimum
+    initTour = perform2Opt(perform2OptParallel(initTour,flightCosts),flightCosts);
+  }
+
+  updateGlobalBest(initTour,evalTourCost(initTour,flightCosts));
+
+  if(rolling)        { rollingHorizonSearch(initTour,flightCosts,timeOut); }
+  else if(portfolio) { portfolioSearch(initTour,flightCosts,sortedOutboundFlights,sortedInboundFlights,timeOut); }
+  else if(lns)       { largeNeighborhoodSearch(initTour,flightCosts,timeOut); }
+  else if(tabu)      { tabuSearch(initTour,flightCosts,timeOut); }
+  else if(guided)    { guidedLocalSearch(initTour,flightCosts,timeOut); }
+  else if(genetic)   { geneticAlgorithm(initTour,flightCosts,sortedOutboundFlights,timeOut); }
+  else if(tempering) { parallelTempering(initTour,flightCosts,timeOut); }
+  else if(anneal)    { simulatedAnnealing(initTour,flightCosts,timeOut); }
+  else               { iteratedLocalSearch(initTour,flightCosts,timeOut); }
+
+  printBestTourAndExit();
+
   return 0;
 }